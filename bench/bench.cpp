@@ -0,0 +1,585 @@
+#include "nes.hpp"
+#include "lockstep.hpp"
+
+#include <iostream>
+#include <iomanip>
+#include <fstream>
+#include <sstream>
+#include <chrono>
+#include <functional>
+#include <filesystem>
+#include <algorithm>
+#include <memory>
+#include <map>
+#include <tuple>
+
+namespace nes{
+
+using Clock = std::chrono::steady_clock;
+
+//Operations done by one run of a benchmark and the time spent on them. Benchmarks time
+//themselves, so setup and the parts of a frame they don't measure stay out of the result
+struct Measurement{
+  u64 operations = 0;
+  double seconds = 0.0;
+};
+
+struct Benchmark{
+  std::string name;
+  std::string unit;
+  std::function<Measurement(u64 operations)> run;
+};
+
+struct BenchmarkResult{
+  std::string name;
+  std::string unit;
+  u64 operations = 0;
+  double ns_per_op = 0.0;
+  double min_ns_per_op = 0.0;
+};
+
+struct BenchOptions{
+  std::string filter;
+  std::string baseline;
+  std::vector<std::string> roms;
+  double min_time = 0.2;
+  u32 repetitions = 5;
+  double threshold = 5.0;
+};
+
+//Results go through here so the compiler can't drop the work that produced them:
+inline volatile u32 sink = 0;
+
+template<typename Callable>
+auto timed(u64 operations, Callable callable){
+  const auto start = Clock::now();
+  callable();
+  return Measurement{ operations, std::chrono::duration<double>(Clock::now() - start).count() };
+}
+
+inline auto seconds_since(Clock::time_point start){
+  return std::chrono::duration<double>(Clock::now() - start).count();
+}
+
+//Minimal NROM-style images for every supported mapper, PRG and CHR filled with a pattern
+inline auto write_mapper_rom(const std::string& filepath, u32 mapper, u32 program_banks, u32 char_banks){
+  auto rom = std::vector<u8>(16 + program_banks * 16_kb + char_banks * 8_kb);
+  const u8 header[] = { 'N', 'E', 'S', 0x1A, u8(program_banks), u8(char_banks), u8((mapper & 0x0F) << 4), u8(mapper & 0xF0) };
+  std::copy(std::begin(header), std::end(header), rom.begin());
+
+  for (auto i : range(16, rom.size())){
+    rom[i] = u8(i * 7 + (i >> 8));
+  }
+
+  auto file = std::ofstream(filepath, std::ios::binary);
+  file.write(reinterpret_cast<const char*>(rom.data()), rom.size());
+}
+
+//Mixed addressing modes, looping forever from $8000
+inline auto write_dispatch_rom(const std::string& filepath){
+  auto rom = std::vector<u8>(16 + 32_kb + 8_kb, 0);
+  const u8 header[] = { 'N', 'E', 'S', 0x1A, 2, 1, 0x00, 0x00 };
+  std::copy(std::begin(header), std::end(header), rom.begin());
+
+  const u8 program[] = {
+    0xA9, 0x01,       //LDA #$01
+    0x65, 0x10,       //ADC $10
+    0x85, 0x11,       //STA $11
+    0xE8,             //INX
+    0x88,             //DEY
+    0x29, 0x0F,       //AND #$0F
+    0x15, 0x12,       //ORA $12,X
+    0xAA,             //TAX
+    0xC8,             //INY
+    0xB1, 0x20,       //LDA ($20),Y
+    0x0A,             //ASL A
+    0xD0, 0x00,       //BNE +0
+    0xEA,             //NOP
+    0x9D, 0x00, 0x03, //STA $0300,X
+    0x4C, 0x00, 0x80  //JMP $8000
+  };
+  std::copy(std::begin(program), std::end(program), rom.begin() + 16);
+
+  const u8 vectors[] = { 0x00, 0x80, 0x00, 0x80, 0x00, 0x80 };
+  std::copy(std::begin(vectors), std::end(vectors), rom.begin() + 16 + 32_kb - 6);
+
+  auto file = std::ofstream(filepath, std::ios::binary);
+  file.write(reinterpret_cast<const char*>(rom.data()), rom.size());
+}
+
+inline auto temp_rom_path(const std::string& name){
+  return (std::filesystem::temp_directory_path() / ("nes_bench_" + name + ".nes")).string();
+}
+
+inline auto make_nes(const std::string& rom_path){
+  auto nes = std::make_unique<Nes>();
+  nes->load_cardridge(rom_path);
+  return nes;
+}
+
+inline auto cpu_benchmarks(std::vector<Benchmark>& benchmarks){
+  const auto rom_path = temp_rom_path("dispatch");
+  write_dispatch_rom(rom_path);
+
+  benchmarks.push_back({ "cpu/execute_instruction", "instruction", [rom_path](u64 operations){
+    const auto nes = make_nes(rom_path);
+    auto& cpu = nes->cpu;
+
+    return timed(operations, [&]{
+      for (auto i : range(operations)){
+        const auto opcode = nes->mem_read(cpu.pc);
+        cpu.instruction_pc = cpu.pc;
+        cpu.pc++;
+        cpu.execute_instruction(*nes, opcode);
+      }
+      sink = cpu.accumulator;
+    });
+  }});
+}
+
+inline auto bus_benchmarks(std::vector<Benchmark>& benchmarks){
+  //Mapper001 has PRG RAM at $6000:
+  const auto rom_path = temp_rom_path("bus");
+  write_mapper_rom(rom_path, 1, 8, 2);
+
+  struct AddressClass{
+    const char* name;
+    u16 first;
+    u16 count;
+  };
+
+  static constexpr AddressClass Classes[] = {
+    { "ram", 0x0000, 0x2000 },
+    { "ppu_register", 0x2000, 0x2000 },
+    { "apu_register", 0x4015, 1 },
+    { "controller", 0x4016, 1 },
+    { "open_bus", 0x4020, 0x1FE0 },
+    { "prg_ram", 0x6000, 0x2000 },
+    { "prg_rom", 0x8000, 0x8000 },
+  };
+
+  for (const auto& address_class : Classes){
+    benchmarks.push_back({ std::string("bus/mem_read/") + address_class.name, "read", [rom_path, address_class](u64 operations){
+      const auto nes = make_nes(rom_path);
+
+      return timed(operations, [&]{
+        auto sum = u32(0);
+        auto offset = u16(0);
+
+        for (auto i : range(operations)){
+          sum += nes->mem_read(address_class.first + offset);
+          offset = offset + 1 == address_class.count ? 0 : offset + 1;
+        }
+        sink = sum;
+      });
+    }});
+  }
+}
+
+enum class ScanlineKind{
+  Visible,
+  PostRender,
+  VBlank,
+  PreRender
+};
+
+inline auto scanline_kind(i32 scanline){
+  if (scanline < 0) return ScanlineKind::PreRender;
+  if (scanline < Ppu::ScreenSize.y) return ScanlineKind::Visible;
+  if (scanline == Ppu::ScreenSize.y) return ScanlineKind::PostRender;
+  return ScanlineKind::VBlank;
+}
+
+inline auto ppu_benchmarks(std::vector<Benchmark>& benchmarks, const std::string& rom_path){
+  static constexpr std::pair<const char*, ScanlineKind> Kinds[] = {
+    { "visible", ScanlineKind::Visible },
+    { "vblank", ScanlineKind::VBlank },
+    { "pre_render", ScanlineKind::PreRender },
+  };
+
+  for (const auto& [name, kind] : Kinds){
+    benchmarks.push_back({ std::string("ppu/clock/") + name, "scanline", [rom_path, kind = kind](u64 operations){
+      const auto nes = make_nes(rom_path);
+
+      //Let the game turn rendering on first:
+      for (auto i : range(30)){
+        nes->run_frame();
+      }
+
+      //Only the PPU is clocked, whole scanlines at a time, and only lines of the wanted kind are timed
+      auto measurement = Measurement();
+      while (measurement.operations < operations){
+        const auto scanline = nes->ppu.scanline;
+        const auto measured = scanline_kind(scanline) == kind;
+        const auto start = Clock::now();
+
+        do{
+          nes->ppu.clock(*nes);
+        } while (nes->ppu.scanline == scanline);
+
+        if (measured){
+          measurement.seconds += seconds_since(start);
+          measurement.operations++;
+        }
+      }
+
+      sink = nes->finished_framebuffer.pixels[0].x;
+      return measurement;
+    }});
+  }
+}
+
+inline auto enable_apu_channels(Apu& apu){
+  const std::pair<u16, u8> writes[] = {
+    { 0x4015, 0x0F },
+    { 0x4000, 0xBF }, { 0x4002, 0xFD }, { 0x4003, 0x08 },
+    { 0x4004, 0x7F }, { 0x4006, 0x40 }, { 0x4007, 0x09 },
+    { 0x400C, 0x3F }, { 0x400E, 0x04 }, { 0x400F, 0x08 },
+  };
+
+  for (const auto& [address, data] : writes){
+    apu.cpu_write(address, data);
+  }
+}
+
+inline auto apu_benchmarks(std::vector<Benchmark>& benchmarks){
+  benchmarks.push_back({ "apu/clock", "cycle", [](u64 operations){
+    auto apu = Apu();
+    enable_apu_channels(apu);
+
+    return timed(operations, [&]{
+      for (auto i : range(operations)){
+        apu.clock();
+      }
+      sink = apu.frame_cycles;
+    });
+  }});
+
+  benchmarks.push_back({ "apu/output", "sample", [](u64 operations){
+    auto apu = Apu();
+    enable_apu_channels(apu);
+
+    return timed(operations, [&]{
+      auto sum = 0.f;
+      auto time = 0.0;
+
+      for (auto i : range(operations)){
+        sum += apu.output(time);
+        time += 1.0 / Nes::AudioSampleRate;
+      }
+      sink = u32(sum);
+    });
+  }});
+}
+
+inline auto mapper_benchmarks(std::vector<Benchmark>& benchmarks){
+  struct MapperRom{
+    u32 mapper;
+    u32 program_banks;
+    u32 char_banks;
+  };
+
+  static constexpr MapperRom Roms[] = {
+    { 0, 2, 1 },
+    { 1, 8, 2 },
+    { 2, 8, 0 },
+    { 3, 4, 4 },
+    { 4, 8, 8 },
+    { 66, 4, 4 },
+  };
+
+  auto rom_paths = std::vector<std::string>();
+
+  for (const auto& rom : Roms){
+    auto name = std::to_string(rom.mapper);
+    name.insert(0, 3 - name.size(), '0');
+    const auto rom_path = temp_rom_path("mapper" + name);
+    write_mapper_rom(rom_path, rom.mapper, rom.program_banks, rom.char_banks);
+    rom_paths.push_back(rom_path);
+
+    benchmarks.push_back({ "mapper/" + name + "/cpu_read", "read", [rom_path](u64 operations){
+      const auto nes = make_nes(rom_path);
+      const auto& cardridge = nes->cardridge;
+
+      return timed(operations, [&]{
+        auto sum = u32(0);
+        auto address = u16(0x8000);
+
+        for (auto i : range(operations)){
+          sum += cardridge.cpu_read(address).value_or(0);
+          address = address == 0xFFFF ? 0x8000 : address + 1;
+        }
+        sink = sum;
+      });
+    }});
+
+    benchmarks.push_back({ "mapper/" + name + "/ppu_read", "read", [rom_path](u64 operations){
+      const auto nes = make_nes(rom_path);
+      const auto& cardridge = nes->cardridge;
+
+      return timed(operations, [&]{
+        auto sum = u32(0);
+        auto address = u16(0);
+
+        for (auto i : range(operations)){
+          sum += cardridge.ppu_read(address).value_or(0);
+          address = (address + 1) & 0x1FFF;
+        }
+        sink = sum;
+      });
+    }});
+  }
+
+  //A register write and a read on a cartridge picked pseudo-randomly among all mappers, so every
+  //access goes through the mapper variant without the branch predictor learning the order. Writes
+  //select bank 0, which every image above has
+  benchmarks.push_back({ "mapper/dispatch", "write+read", [rom_paths](u64 operations){
+    auto instances = std::vector<std::unique_ptr<Nes>>();
+    for (const auto& rom_path : rom_paths){
+      instances.push_back(make_nes(rom_path));
+    }
+
+    auto order = std::vector<Cardridge*>(1024);
+    auto seed = u32(0x2545F491);
+    for (auto& cardridge : order){
+      seed ^= seed << 13;
+      seed ^= seed >> 17;
+      seed ^= seed << 5;
+      cardridge = &instances[seed % instances.size()]->cardridge;
+    }
+
+    return timed(operations, [&]{
+      auto sum = u32(0);
+
+      for (auto i : range(operations)){
+        auto& cardridge = *order[i & (order.size() - 1)];
+        const auto address = u16(0x8000 | ((i * 0x1FC1) & 0x7FFF));
+
+        cardridge.cpu_write(address, 0);
+        sum += cardridge.cpu_read(address ^ 0x4000).value_or(0);
+      }
+      sink = sum;
+    });
+  }});
+}
+
+inline auto frame_benchmarks(std::vector<Benchmark>& benchmarks, const std::vector<std::string>& roms){
+  for (const auto& rom_path : roms){
+    benchmarks.push_back({ "frame/" + RomImage::get_game_name(rom_path), "frame", [rom_path](u64 operations){
+      const auto nes = make_nes(rom_path);
+
+      return timed(operations, [&]{
+        for (auto i : range(operations)){
+          nes->run_frame();
+        }
+        sink = nes->frame_hash();
+      });
+    }});
+
+    for (const auto& [suffix, mode, interval] : { std::make_tuple("/skip4", Ppu::RenderMode::Skip, 4), std::make_tuple("/timing_only", Ppu::RenderMode::TimingOnly, 1) }){
+      benchmarks.push_back({ "frame/" + RomImage::get_game_name(rom_path) + suffix, "frame", [rom_path, mode = mode, interval = interval](u64 operations){
+        const auto nes = make_nes(rom_path);
+        nes->ppu.set_render_mode(mode, interval);
+
+        return timed(operations, [&]{
+          for (auto i : range(operations)){
+            nes->run_frame();
+          }
+          sink = nes->frame_hash();
+        });
+      }});
+    }
+
+    //Per lane frame, to compare against the scalar frame above:
+    benchmarks.push_back({ "frame/lockstep8/" + RomImage::get_game_name(rom_path), "lane frame", [rom_path](u64 operations){
+      constexpr auto Lanes = 8;
+      auto lockstep = std::make_unique<Lockstep<Lanes>>();
+      lockstep->load_cardridge(rom_path);
+
+      const auto frames = (operations + Lanes - 1) / Lanes;
+      auto measurement = timed(frames, [&]{
+        for (auto i : range(frames)){
+          lockstep->run_frame();
+        }
+        sink = lockstep->frame_hash(0);
+      });
+
+      measurement.operations = frames * Lanes;
+      return measurement;
+    }});
+  }
+}
+
+//Clones a running instance, the way tree search branches from a state
+inline auto clone_benchmarks(std::vector<Benchmark>& benchmarks, const std::vector<std::string>& roms){
+  for (const auto& rom_path : roms){
+    for (const auto visual_mode : { true, false }){
+      const auto name = std::string(visual_mode ? "clone/" : "clone/no_frames/") + RomImage::get_game_name(rom_path);
+
+      benchmarks.push_back({ name, "clone", [rom_path, visual_mode](u64 operations){
+        auto nes = std::make_unique<Nes>(visual_mode);
+        nes->load_cardridge(rom_path);
+        nes->run_frame();
+
+        return timed(operations, [&]{
+          for (auto i : range(operations)){
+            sink = nes->clone()->ram[i & (Nes::CpuMemSize - 1)];
+          }
+        });
+      }});
+    }
+  }
+}
+
+//Grows the operation count until one run takes 'min_time', then keeps the median of the repetitions
+inline auto run_benchmark(const Benchmark& benchmark, const BenchOptions& options){
+  auto operations = u64(1);
+  auto measurement = benchmark.run(operations);
+
+  while (measurement.seconds < options.min_time / 10){
+    operations *= 10;
+    measurement = benchmark.run(operations);
+  }
+  operations = std::max<u64>(1, operations * options.min_time / std::max(measurement.seconds, 1e-9));
+
+  auto samples = std::vector<double>();
+  for (auto i : range(options.repetitions)){
+    const auto measurement = benchmark.run(operations);
+    samples.push_back(measurement.seconds * 1e9 / measurement.operations);
+  }
+  std::sort(samples.begin(), samples.end());
+
+  return BenchmarkResult{ benchmark.name, benchmark.unit, operations, samples[samples.size() / 2], samples.front() };
+}
+
+//Reads back the "name" and "ns_per_op" pairs of a previous run's JSON
+inline auto load_baseline(const std::string& filepath){
+  auto file = std::ifstream(filepath);
+  if (!file){
+    throw std::runtime_error("Unable to open baseline: " + filepath);
+  }
+
+  auto baseline = std::map<std::string, double>();
+  auto name = std::string();
+  auto line = std::string();
+
+  while (std::getline(file, line)){
+    static const auto NameKey = std::string("\"name\": \"");
+    static const auto TimeKey = std::string("\"ns_per_op\": ");
+
+    const auto name_at = line.find(NameKey);
+    if (name_at != std::string::npos){
+      const auto begin = name_at + NameKey.size();
+      name = line.substr(begin, line.find('"', begin) - begin);
+    }
+
+    const auto time_at = line.find(TimeKey);
+    if (time_at != std::string::npos && !name.empty()){
+      baseline[name] = std::stod(line.substr(time_at + TimeKey.size()));
+    }
+  }
+
+  return baseline;
+}
+
+inline auto write_json(std::ostream& out, const std::vector<BenchmarkResult>& results, const std::map<std::string, double>& baseline){
+  out << std::setprecision(6) << "{\n  \"benchmarks\": [";
+
+  for (auto i : range(results.size())){
+    const auto& result = results[i];
+
+    out << (i > 0 ? "," : "") << "\n    {\n";
+    out << "      \"name\": \"" << result.name << "\",\n";
+    out << "      \"unit\": \"" << result.unit << "\",\n";
+    out << "      \"operations\": " << result.operations << ",\n";
+    out << "      \"ns_per_op\": " << result.ns_per_op << ",\n";
+    out << "      \"min_ns_per_op\": " << result.min_ns_per_op << ",\n";
+    out << "      \"ops_per_sec\": " << 1e9 / result.ns_per_op;
+
+    const auto found = baseline.find(result.name);
+    if (found != baseline.end()){
+      out << ",\n      \"baseline_ns_per_op\": " << found->second << ",\n";
+      out << "      \"change_percent\": " << (result.ns_per_op / found->second - 1.0) * 100.0;
+    }
+
+    out << "\n    }";
+  }
+
+  out << "\n  ]\n}\n";
+}
+
+} //namespace nes
+
+auto main(int argc, char** argv) -> int{
+  auto options = nes::BenchOptions();
+
+  for (auto i = 1; i < argc; ++i){
+    const auto argument = std::string(argv[i]);
+    const auto has_value = i + 1 < argc;
+
+    if (argument == "--filter" && has_value) options.filter = argv[++i];
+    else if (argument == "--baseline" && has_value) options.baseline = argv[++i];
+    else if (argument == "--rom" && has_value) options.roms.push_back(argv[++i]);
+    else if (argument == "--min-time" && has_value) options.min_time = std::stod(argv[++i]);
+    else if (argument == "--repetitions" && has_value) options.repetitions = std::max(1, std::stoi(argv[++i]));
+    else if (argument == "--threshold" && has_value) options.threshold = std::stod(argv[++i]);
+    else{
+      std::cerr
+        << "Usage: " << argv[0] << " [--filter text] [--rom path]... [--min-time seconds] [--repetitions n]\n"
+        << "       [--baseline previous.json] [--threshold percent]\n";
+      return 1;
+    }
+  }
+
+  if (options.roms.empty()){
+    options.roms.push_back("nestest.nes");
+  }
+
+  try{
+    auto benchmarks = std::vector<nes::Benchmark>();
+    nes::cpu_benchmarks(benchmarks);
+    nes::bus_benchmarks(benchmarks);
+    nes::ppu_benchmarks(benchmarks, options.roms.front());
+    nes::apu_benchmarks(benchmarks);
+    nes::mapper_benchmarks(benchmarks);
+    nes::frame_benchmarks(benchmarks, options.roms);
+    nes::clone_benchmarks(benchmarks, options.roms);
+
+    const auto baseline = options.baseline.empty() ? std::map<std::string, double>() : nes::load_baseline(options.baseline);
+
+    auto results = std::vector<nes::BenchmarkResult>();
+    auto regressions = 0;
+
+    for (const auto& benchmark : benchmarks){
+      if (benchmark.name.find(options.filter) == std::string::npos) continue;
+
+      const auto& result = results.emplace_back(nes::run_benchmark(benchmark, options));
+
+      //Progress and the comparison go to stderr, stdout only carries the JSON:
+      std::cerr << std::left << std::setw(32) << result.name << std::right << std::setw(12) << std::fixed << std::setprecision(2)
+        << result.ns_per_op << " ns/" << result.unit;
+
+      const auto found = baseline.find(result.name);
+      if (found != baseline.end()){
+        const auto change = (result.ns_per_op / found->second - 1.0) * 100.0;
+        const auto regressed = change > options.threshold;
+        if (regressed) regressions++;
+
+        std::cerr << "  " << std::showpos << change << std::noshowpos << "%" << (regressed ? "  REGRESSION" : "");
+      }
+
+      std::cerr << std::defaultfloat << '\n';
+    }
+
+    nes::write_json(std::cout, results, baseline);
+
+    if (regressions > 0){
+      std::cerr << regressions << " benchmarks slower than the baseline by more than " << options.threshold << "%\n";
+      return 2;
+    }
+  }
+  catch(const std::runtime_error& error){
+    std::cerr << error.what() << '\n';
+    return 1;
+  }
+}
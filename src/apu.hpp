@@ -2,6 +2,9 @@
 
 #include "aliases.hpp"
 #include "audio.hpp"
+#include <algorithm>
+#include <stdexcept>
+#include <string>
 
 namespace nes{
 
@@ -36,6 +39,48 @@ struct Sequencer{
   }
 };
 
+//Fires 'sample_rate' times per 'clock_rate' ticks. The next sample tick is precomputed with an
+//integer remainder (Bresenham-style), so the schedule is exact and identical on every compiler
+struct SampleClock{
+  u32 clock_rate;
+  u32 sample_rate;
+  u32 countdown = 0;
+  u32 remainder = 0;
+  u64 ticks = 0;
+
+  //At most one sample per tick, otherwise 'countdown' could be scheduled as 0 and wrap around
+  SampleClock(u32 clock_rate, u32 sample_rate) 
+  : clock_rate(clock_rate), sample_rate(sample_rate){
+    if (sample_rate == 0 || sample_rate > clock_rate){
+      throw std::runtime_error("Invalid audio sample rate: " + std::to_string(sample_rate));
+    }
+
+    schedule();
+  }
+
+  auto schedule() -> void{
+    remainder += clock_rate;
+    countdown = remainder / sample_rate;
+    remainder %= sample_rate;
+  }
+
+  auto tick(){
+    ticks++;
+    countdown--;
+
+    if (countdown == 0){
+      schedule();
+      return true;
+    }
+
+    return false;
+  }
+
+  auto time() const{
+    return double(ticks) / clock_rate;
+  }
+};
+
 struct Envelope{
   bool const_volume = false;
   bool loop = false;
@@ -157,7 +202,7 @@ struct PulseChannel{
   Sweep sweep;
   LengthCounter length_counter;
   bool enabled = false;
-  double duty;
+  double duty = 0.0;
 
   bool pulse1 = false;
 
@@ -194,15 +239,67 @@ struct PulseChannel{
   }
 };
 
+//Both LFSR modes are periodic, so they are unrolled once into bit tables and the channel
+//only keeps a position. Advancing by any number of timer periods is an add and a modulo
+struct NoiseSequences{
+  static constexpr auto Seed = 0x7FFF;
+  static constexpr auto LongPeriod = 32767;
+  static constexpr auto ShortPeriod = 93;
+
+  u8 long_bits[(LongPeriod + 7) / 8]{};
+  u8 short_bits[(ShortPeriod + 7) / 8]{};
+
+  NoiseSequences(){
+    generate(long_bits, LongPeriod, 1);
+    generate(short_bits, ShortPeriod, 6);
+  }
+
+  static auto generate(u8* bits, u32 period, u8 tap) -> void{
+    u16 sequence = Seed;
+
+    for (auto i : range(period)){
+      bits[i >> 3] |= (sequence & 1) << (i & 7);
+
+      const auto feedback = (sequence & 1) ^ ((sequence >> tap) & 1);
+      sequence = (feedback << 14) | (sequence >> 1);
+    }
+  }
+
+  static auto period(bool mode) -> u32{
+    return mode ? ShortPeriod : LongPeriod;
+  }
+
+  auto bit(bool mode, u32 index) const{
+    const auto bits = mode ? short_bits : long_bits;
+    return (bits[index >> 3] >> (index & 7)) & 1;
+  }
+
+  static auto get() -> const NoiseSequences&{
+    static const auto sequences = NoiseSequences();
+    return sequences;
+  }
+};
+
 struct NoiseChannel{
   Envelope envelope;
   LengthCounter length_counter;
   Sequencer sequencer;
   bool enabled = false;
   bool mode = 0;
+  u16 sequence_index = 0;
 
-  NoiseChannel(){
-    sequencer.sequence = 0x7FFF;
+  auto update_mode(u8 data){
+    mode = data & 0x80;
+    sequence_index %= NoiseSequences::period(mode);
+  }
+
+  auto advance(u32 steps){
+    sequence_index = (sequence_index + steps) % NoiseSequences::period(mode);
+  }
+
+  //Shift register bit 0 after 'steps' more timer periods, without changing the channel
+  auto bit(u32 steps = 0) const{
+    return NoiseSequences::get().bit(mode, (sequence_index + steps) % NoiseSequences::period(mode));
   }
 
   auto clock(bool quarter_frame_clock, bool half_frame_clock){
@@ -214,30 +311,26 @@ struct NoiseChannel{
       length_counter.clock(enabled, envelope.loop);
     }
 
-    sequencer.clock(enabled, [](u16 sequence){
-      const auto bit0 = sequence & 1;
-      const auto bit1 = (sequence & 2) >> 1;
-
-      return ((bit0 ^ bit1) << 14) | (sequence >> 1);
+    sequencer.clock(enabled, [&](u16 sequence){
+      advance(1);
+      return sequence;
     });
   }
 
   auto output(){
     if (!enabled || length_counter.counter == 0) return 0.f;
-    return ((~sequencer.sequence) & 1 ? 1.f : -1.f) * envelope.output();
+    return (bit() ? -1.f : 1.f) * envelope.output();
   }
 };
 
 struct Apu{
-  AudioPlayer<Nes> sound;
   PulseChannel pulse1;
   PulseChannel pulse2;
   NoiseChannel noise;
   u32 cycles = 0;
   u32 frame_cycles = 0;
 
-  Apu(Nes& nes){
-    sound.init(nes);
+  Apu(){
     pulse1.pulse1 = true;
   }
 
@@ -306,6 +399,7 @@ struct Apu{
         };
 
         noise.sequencer.reload = noise_reload_table[data & 0x0F];
+        noise.update_mode(data);
         break;
       }
 
@@ -351,14 +445,13 @@ struct Apu{
     cycles++;
   }
 
-  auto play(AudioPlayer<Nes>::callback_t callback){
-    sound.play(callback);
-  }
+  auto output(double time){
+    const auto pulse_out = 0.00752f * (pulse1.output(time) + pulse2.output(time));
+    const auto noise_out = 0.00494f * noise.output();
+    const auto final_sample = pulse_out + noise_out;
 
-  auto stop(){
-    sound.stop();
+    return std::clamp(final_sample, -1.f, 1.f);
   }
-
 };
 
 } //namespace nes
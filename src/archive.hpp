@@ -0,0 +1,176 @@
+#pragma once
+
+#include "aliases.hpp"
+#include "util.hpp"
+#include "inflate.hpp"
+#include "hash.hpp"
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <stdexcept>
+
+namespace nes{
+
+//Reads the ROM out of a .zip or .gz file in memory, inflating it straight into the image buffer
+struct Archive{
+  static constexpr u32 ZipLocalHeader = 0x04034B50;
+  static constexpr u32 ZipCentralHeader = 0x02014B50;
+  static constexpr u32 ZipEndOfDirectory = 0x06054B50;
+
+  static constexpr auto MethodStored = 0;
+  static constexpr auto MethodDeflate = 8;
+
+  //The largest plain iNES image is about 6Mb. NES 2.0 allows more, but no cartridge comes near
+  //this, so bigger sizes in a header mean a corrupt or hostile archive:
+  static constexpr auto MaxImageSize = 64 * 1024_kb;
+
+  static auto read_u16(Span<const u8> data, std::size_t offset) -> u16{
+    if (offset + 2 > data.size()) throw std::runtime_error("Truncated archive");
+    return data[offset] | (data[offset + 1] << 8);
+  }
+
+  static auto read_u32(Span<const u8> data, std::size_t offset) -> u32{
+    return read_u16(data, offset) | (u32(read_u16(data, offset + 2)) << 16);
+  }
+
+  static auto is_zip(Span<const u8> data){
+    return data.size() >= 4 && read_u32(data, 0) == ZipLocalHeader;
+  }
+
+  static auto is_gzip(Span<const u8> data){
+    return data.size() >= 18 && data[0] == 0x1F && data[1] == 0x8B;
+  }
+
+  static auto is_archive(Span<const u8> data){
+    return is_zip(data) || is_gzip(data);
+  }
+
+  static auto has_rom_extension(const std::string& name){
+    if (name.size() < 4) return false;
+
+    auto extension = name.substr(name.size() - 4);
+    std::transform(extension.begin(), extension.end(), extension.begin(), [](char c){ return std::tolower(c); });
+    return extension == ".nes";
+  }
+
+  static auto extract(Span<const u8> data, const std::string& filepath) -> std::vector<u8>{
+    return is_zip(data) ? extract_zip(data, filepath) : extract_gzip(data, filepath);
+  }
+
+  static auto unpack(Span<const u8> compressed, u32 method, u32 size, u32 crc, const std::string& filepath){
+    if (size > MaxImageSize) throw std::runtime_error("Archive member too large: " + filepath);
+
+    auto output = std::vector<u8>();
+    output.reserve(size);
+
+    if (method == MethodStored){
+      if (size > compressed.size()) throw std::runtime_error("Truncated archive: " + filepath);
+      output.assign(compressed.begin(), compressed.begin() + size);
+    }
+    else if (method == MethodDeflate){
+      //Stops at the declared size, instead of finding out after inflating whatever is there:
+      Inflate::decode(compressed, output, size);
+    }
+    else{
+      throw std::runtime_error("Unsupported compression method in: " + filepath);
+    }
+
+    if (output.size() != size || crc32(output) != crc){
+      throw std::runtime_error("Corrupted archive: " + filepath);
+    }
+
+    return output;
+  }
+
+  //Takes the first member ending in ".nes", or the first file when there is none
+  static auto extract_zip(Span<const u8> data, const std::string& filepath) -> std::vector<u8>{
+    if (data.size() < 22) throw std::runtime_error("Truncated archive: " + filepath);
+
+    //The end of central directory record sits before an optional comment of up to 64Kb:
+    auto end = data.size() - 22;
+    const auto search_limit = end > 0xFFFF ? end - 0xFFFF : 0;
+    while (read_u32(data, end) != ZipEndOfDirectory){
+      if (end == search_limit) throw std::runtime_error("Invalid zip archive: " + filepath);
+      end--;
+    }
+
+    const auto entries = read_u16(data, end + 10);
+    auto offset = std::size_t(read_u32(data, end + 16));
+
+    auto chosen = std::size_t(0);
+    auto found = false;
+
+    for (auto i : range(entries)){
+      if (read_u32(data, offset) != ZipCentralHeader) throw std::runtime_error("Invalid zip archive: " + filepath);
+
+      const auto name_length = read_u16(data, offset + 28);
+      const auto extra_length = read_u16(data, offset + 30);
+      const auto comment_length = read_u16(data, offset + 32);
+
+      if (offset + 46 + name_length > data.size()) throw std::runtime_error("Truncated archive: " + filepath);
+      const auto name = std::string(reinterpret_cast<const char*>(data.data() + offset + 46), name_length);
+      const auto is_directory = !name.empty() && name.back() == '/';
+
+      if (!is_directory && (!found || has_rom_extension(name))){
+        chosen = offset;
+        found = true;
+        if (has_rom_extension(name)) break;
+      }
+
+      offset += 46 + name_length + extra_length + comment_length;
+    }
+
+    if (!found) throw std::runtime_error("Empty zip archive: " + filepath);
+
+    const auto flags = read_u16(data, chosen + 8);
+    const auto method = read_u16(data, chosen + 10);
+    const auto crc = read_u32(data, chosen + 16);
+    const auto compressed_size = read_u32(data, chosen + 20);
+    const auto size = read_u32(data, chosen + 24);
+    const auto local_offset = read_u32(data, chosen + 42);
+
+    if (flags & 0x01) throw std::runtime_error("Encrypted zip archives are not supported: " + filepath);
+    if (size == 0xFFFFFFFF || local_offset == 0xFFFFFFFF) throw std::runtime_error("Zip64 archives are not supported: " + filepath);
+    if (read_u32(data, local_offset) != ZipLocalHeader) throw std::runtime_error("Invalid zip archive: " + filepath);
+
+    const auto data_offset = local_offset + 30 + read_u16(data, local_offset + 26) + read_u16(data, local_offset + 28);
+    if (data_offset + compressed_size > data.size()) throw std::runtime_error("Truncated archive: " + filepath);
+
+    return unpack(data.subspan(data_offset, compressed_size), method, size, crc, filepath);
+  }
+
+  static auto extract_gzip(Span<const u8> data, const std::string& filepath) -> std::vector<u8>{
+    enum Flags : u8{
+      HeaderCrc = 1 << 1,
+      Extra = 1 << 2,
+      Name = 1 << 3,
+      Comment = 1 << 4
+    };
+
+    if (data[2] != MethodDeflate) throw std::runtime_error("Unsupported compression method in: " + filepath);
+
+    const auto flags = data[3];
+    auto offset = std::size_t(10);
+
+    if (flags & Extra) offset += 2 + read_u16(data, offset);
+
+    for (const auto field : { Name, Comment }){
+      if (!(flags & field)) continue;
+
+      while (offset < data.size() && data[offset] != 0) offset++;
+      offset++;
+    }
+
+    if (flags & HeaderCrc) offset += 2;
+
+    if (offset + 8 > data.size()) throw std::runtime_error("Truncated archive: " + filepath);
+
+    //The trailer holds the CRC and size of the uncompressed data:
+    const auto crc = read_u32(data, data.size() - 8);
+    const auto size = read_u32(data, data.size() - 4);
+
+    return unpack(data.subspan(offset, data.size() - 8 - offset), MethodDeflate, size, crc, filepath);
+  }
+};
+
+} //namespace nes
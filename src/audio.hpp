@@ -5,6 +5,9 @@
 #include <miniaudio.h>
 #include <stdexcept>
 #include <functional>
+#include <atomic>
+#include <chrono>
+#include <algorithm>
 
 namespace nes{
 
@@ -23,49 +26,190 @@ inline auto square_wave(double step, double frequency, float duty){
   return 0.5f * (y1 - y2);
 }
 
+struct AudioLatency{
+  //0 lets miniaudio pick:
+  u32 period_frames = 0;
+  u32 periods = 0;
+
+  //Start with 'period_frames' and double it (up to 'max_period_frames') after underruns:
+  bool adaptive = false;
+  u32 max_period_frames = 4096;
+
+  static auto low(){
+    auto latency = AudioLatency();
+    latency.period_frames = 128;
+    latency.periods = 2;
+    latency.adaptive = true;
+
+    return latency;
+  }
+
+  //Period to retry with after an underrun: twice the current one, at most 'max_period_frames'.
+  //0 (miniaudio's choice) stays 0
+  auto grown_period(u32 current) const -> u32{
+    if (current == 0) return 0;
+    return std::min(current * 2, std::max(current, max_period_frames));
+  }
+};
+
+//Measures output latency and underruns from when blocks are written. The device plays
+//'sample_rate' frames per second from the first block on, so at any moment it has consumed
+//(now - start) * sample_rate frames; what was written and not consumed yet is the latency. When
+//the device should have consumed more than was written it ran dry and played silence in between
+struct PlaybackMonitor{
+  double sample_rate = 44100.0;
+
+  //Frames the device can hold, the device clock is pulled back when it lags further behind:
+  u64 capacity = 0;
+
+  u64 written = 0;
+  double start = 0.0;
+  u32 underruns = 0;
+  double latency_ms = 0.0;
+
+  PlaybackMonitor() {}
+  PlaybackMonitor(double sample_rate, u64 capacity) : sample_rate(sample_rate), capacity(capacity) {}
+
+  //Call once 'frames' frames have been handed to the device, 'now' in seconds:
+  auto block_written(double now, u32 frames) -> void{
+    if (written == 0){
+      start = now;
+    }
+
+    auto consumed = (now - start) * sample_rate;
+
+    //Silence was played since the previous block, playback resumes with this one:
+    if (consumed > written){
+      underruns++;
+      start = now - written / sample_rate;
+      consumed = written;
+    }
+
+    written += frames;
+
+    //The device clock drifts against ours; it can never hold more than its buffer and this block:
+    const auto limit = double(capacity + frames);
+    if (written - consumed > limit){
+      consumed = written - limit;
+      start = now - consumed / sample_rate;
+    }
+
+    latency_ms = 1000.0 * (written - consumed) / sample_rate;
+  }
+};
+
+//Written by the device thread, readable from any thread
+struct AudioTelemetry{
+  std::atomic<u32> underruns{ 0 };
+  std::atomic<u32> buffer_frames{ 0 };
+
+  //Time spent producing the last block:
+  std::atomic<float> callback_ms{ 0.f };
+
+  //Measured by PlaybackMonitor, from the end of a write until the device plays its last frame:
+  std::atomic<float> latency_ms{ 0.f };
+};
+
 template<typename Data>
 struct AudioPlayer{
-  using callback_t = std::function<float(Data&)>; 
-  inline static callback_t current_callback;
-  inline static auto cycles = u32(0);
+  using clock_t = std::chrono::steady_clock;
+
+  //Fills 'frame_count' frames of interleaved samples ('channels' floats per frame):
+  using callback_t = std::function<void(Data&, float* output, u32 frame_count)>; 
+
+  callback_t callback;
+  Data* data = nullptr;
+  u32 channels = 1;
+  u32 cycles = 0;
+
+  AudioLatency latency;
+  AudioTelemetry telemetry;
+  PlaybackMonitor monitor;
+  u32 handled_underruns = 0;
 
   ma_device_config config;
   ma_device device;
 
-  AudioPlayer(double sample_rate){
+  AudioPlayer(double sample_rate, u32 channels = 1, const AudioLatency& latency = {}) 
+  : channels(channels), latency(latency){
     config = ma_device_config_init(ma_device_type_playback);
 
     config.playback.format = ma_format_f32;
-    config.playback.channels = 1;
+    config.playback.channels = channels;
     config.sampleRate = static_cast<ma_uint32>(sample_rate);
+    config.periodSizeInFrames = latency.period_frames;
+    config.periods = latency.periods;
+
+    if (latency.period_frames > 0){
+      config.performanceProfile = ma_performance_profile_low_latency;
+    }
 
     config.dataCallback = [](ma_device* device, void* output, const void*, ma_uint32 frame_count){
-      auto out = static_cast<float*>(output);
-      auto& data = *static_cast<Data*>(device->pUserData);
+      auto& player = *static_cast<AudioPlayer*>(device->pUserData);
+      const auto start = clock_t::now();
 
-      for (ma_uint32 i = 0; i < frame_count; i++) {
-        *out++ = AudioPlayer::current_callback(data);
-        cycles++;
-      }
+      player.callback(*player.data, static_cast<float*>(output), frame_count);
+      player.cycles += frame_count;
+      player.measure(start, clock_t::now(), frame_count);
     };
   }
 
+  auto buffer_frames() const{
+    return device.playback.internalPeriodSizeInFrames * device.playback.internalPeriods;
+  }
+
+  auto measure(clock_t::time_point start, clock_t::time_point end, u32 frame_count){
+    using ms = std::chrono::duration<float, std::milli>;
+    using seconds = std::chrono::duration<double>;
+
+    monitor.block_written(seconds(end.time_since_epoch()).count(), frame_count);
+
+    telemetry.underruns = monitor.underruns;
+    telemetry.buffer_frames = buffer_frames();
+    telemetry.callback_ms = ms(end - start).count();
+    telemetry.latency_ms = monitor.latency_ms;
+  }
+
   auto init(Data& data){
-    config.pUserData = &data;
+    this->data = &data;
+    config.pUserData = this;
 
     if (ma_device_init(NULL, &config, &device) != MA_SUCCESS) {
       throw std::runtime_error("Unable to initialise miniaudio device");
     }
+
+    //A new device starts from an empty buffer, underruns keep counting across restarts:
+    const auto underruns = monitor.underruns;
+    monitor = PlaybackMonitor(device.sampleRate, buffer_frames());
+    monitor.underruns = underruns;
   }
 
   AudioPlayer() : AudioPlayer(44100.0) {}
 
   auto play(callback_t callback){
-    AudioPlayer::current_callback = callback;
+    this->callback = std::move(callback);
     
     ma_device_start(&device);
   }
 
+  //Call from the thread that owns the player (never from the callback); grows the buffer after underruns
+  auto adapt(){
+    if (!latency.adaptive) return;
+
+    const auto underruns = telemetry.underruns.load();
+    if (underruns == handled_underruns) return;
+    handled_underruns = underruns;
+
+    const auto period = latency.grown_period(config.periodSizeInFrames);
+    if (period == config.periodSizeInFrames) return;
+
+    ma_device_uninit(&device);
+    config.periodSizeInFrames = period;
+
+    init(*data);
+    ma_device_start(&device);
+  }
+
   auto stop(){
     ma_device_stop(&device);
   }
@@ -0,0 +1,123 @@
+#pragma once
+
+#include "aliases.hpp"
+#include "util.hpp"
+#include <array>
+#include <vector>
+#include <fstream>
+#include <string>
+#include <cstring>
+
+namespace nes{
+
+//Receives mixed mono samples while the emulator runs, independently of any sound device
+struct AudioSink{
+  static constexpr auto BlockSize = 1024;
+
+  std::array<float, BlockSize> block;
+  u32 block_size = 0;
+
+  auto push(float sample){
+    block[block_size++] = sample;
+
+    if (block_size == BlockSize){
+      flush();
+    }
+  }
+
+  auto flush() -> void{
+    if (block_size == 0) return;
+
+    write(block.data(), block_size);
+    block_size = 0;
+  }
+
+  virtual auto write(const float* samples, u32 count) -> void = 0;
+  virtual ~AudioSink() {}
+};
+
+//Collects every sample in memory. Samples short of a full block reach 'samples' only on flush():
+//Nes::render_audio flushes before it returns, anything else pushing through Nes::audio_sink must
+//call flush() before reading 'samples'
+struct MemoryAudioSink : AudioSink{
+  std::vector<float> samples;
+
+  auto write(const float* samples, u32 count) -> void override{
+    this->samples.insert(this->samples.end(), samples, samples + count);
+  }
+};
+
+//Streams 32-bit float PCM into a RIFF/WAVE file; sizes are patched in when the sink is destroyed
+struct WavAudioSink : AudioSink{
+  static constexpr auto HeaderSize = 44;
+  static constexpr auto FloatFormat = 3;
+
+  std::ofstream file;
+  u32 sample_rate;
+  u32 samples_written = 0;
+
+  WavAudioSink(const std::string& filepath, u32 sample_rate)
+  : file(filepath, std::ios::binary), sample_rate(sample_rate){
+    if (!file){
+      throw std::runtime_error("Unable to open file: " + filepath);
+    }
+
+    write_header();
+  }
+
+  auto write_u16(u16 value){
+    const char bytes[2] = { char(value & 0xFF), char(value >> 8) };
+    file.write(bytes, 2);
+  }
+
+  auto write_u32(u32 value){
+    write_u16(value & 0xFFFF);
+    write_u16(value >> 16);
+  }
+
+  auto write_header() -> void{
+    const auto data_size = samples_written * u32(sizeof(float));
+
+    file.write("RIFF", 4);
+    write_u32(HeaderSize - 8 + data_size);
+    file.write("WAVE", 4);
+
+    file.write("fmt ", 4);
+    write_u32(16);
+    write_u16(FloatFormat);
+    write_u16(1); //Channels
+    write_u32(sample_rate);
+    write_u32(sample_rate * sizeof(float));
+    write_u16(sizeof(float));
+    write_u16(32);
+
+    file.write("data", 4);
+    write_u32(data_size);
+  }
+
+  auto write(const float* samples, u32 count) -> void override{
+    //Little-endian regardless of the host, so output is byte-comparable across machines
+    auto bytes = std::vector<char>(count * sizeof(float));
+
+    for (auto i : range(count)){
+      auto bits = u32(0);
+      std::memcpy(&bits, &samples[i], sizeof(bits));
+
+      for (auto byte : range(sizeof(bits))){
+        bytes[i * sizeof(bits) + byte] = char((bits >> (byte * 8)) & 0xFF);
+      }
+    }
+
+    file.write(bytes.data(), bytes.size());
+    samples_written += count;
+  }
+
+  ~WavAudioSink() override{
+    flush();
+
+    file.seekp(0);
+    write_header();
+  }
+};
+
+} //namespace nes
@@ -0,0 +1,134 @@
+#pragma once
+
+#include "aliases.hpp"
+#include "util.hpp"
+#include <array>
+#include <vector>
+#include <string>
+#include <ostream>
+#include <algorithm>
+
+namespace nes{
+
+//Bank-switch instrumentation policies for the mappers. NoBankTrace is the default and compiles
+//every hook away; configure with -DNES_BANK_TRACE=ON to record with BankTrace instead
+struct NoBankTrace{
+  static constexpr auto Enabled = false;
+
+  auto set_time(u64) -> void{}
+  auto bank_write(u8, u16, u8) -> void{}
+  auto write_json(std::ostream&, const std::string&, u32) -> void{}
+};
+
+struct BankTrace{
+  static constexpr auto Enabled = true;
+
+  static constexpr auto RegisterCount = 8;
+  static constexpr auto EventCapacity = 4096;
+  static constexpr auto DotsPerFrame = 263 * 342;
+
+  struct Event{
+    u64 dot;
+    u16 address;
+    u8 data;
+    u8 bank_register;
+  };
+
+  //PPU dot of the write being traced, set by Nes before it reaches the mapper:
+  u64 dot = 0;
+
+  std::array<u64, RegisterCount> register_writes{};
+  std::vector<u32> frame_writes;
+
+  //Most recent bank switches, older ones are overwritten:
+  Ring<Event> events = Ring<Event>(EventCapacity);
+  u64 event_count = 0;
+
+  auto set_time(u64 dot) -> void{
+    this->dot = dot;
+  }
+
+  auto bank_write(u8 bank_register, u16 address, u8 data) -> void{
+    register_writes[bank_register % RegisterCount]++;
+
+    const auto frame = dot / DotsPerFrame;
+    if (frame_writes.size() <= frame){
+      frame_writes.resize(frame + 1, 0);
+    }
+    frame_writes[frame]++;
+
+    events.push(Event{ dot, address, data, bank_register });
+    event_count++;
+  }
+
+  //Per-game summary as one JSON object
+  auto write_json(std::ostream& out, const std::string& game_name, u32 mapper_id) -> void{
+    auto total = u64(0);
+    for (const auto count : register_writes){
+      total += count;
+    }
+
+    const auto frames = std::max<std::size_t>(frame_writes.size(), 1);
+    const auto busiest_frame = frame_writes.empty() ? 0 : *std::max_element(frame_writes.begin(), frame_writes.end());
+    const auto frames_with_writes = std::count_if(frame_writes.begin(), frame_writes.end(), [](auto count){ return count > 0; });
+
+    out << "{\n";
+    out << "  \"game\": \"" << json_escape(game_name) << "\",\n";
+    out << "  \"mapper\": " << mapper_id << ",\n";
+    out << "  \"frames\": " << frame_writes.size() << ",\n";
+    out << "  \"bank_writes\": " << total << ",\n";
+    out << "  \"writes_per_frame\": " << double(total) / frames << ",\n";
+    out << "  \"busiest_frame_writes\": " << busiest_frame << ",\n";
+    out << "  \"frames_with_writes\": " << frames_with_writes << ",\n";
+
+    out << "  \"register_writes\": [";
+    for (auto i : range(RegisterCount)){
+      out << (i > 0 ? ", " : "") << register_writes[i];
+    }
+    out << "],\n";
+
+    out << "  \"frame_writes\": [";
+    for (auto i : range(frame_writes.size())){
+      out << (i > 0 ? ", " : "") << frame_writes[i];
+    }
+    out << "],\n";
+
+    //Oldest first:
+    auto recent = std::vector<Event>();
+    events.for_each([&](const Event& event, auto){
+      if (recent.size() == std::min<u64>(event_count, EventCapacity)) return false;
+      recent.push_back(event);
+      return true;
+    });
+    std::reverse(recent.begin(), recent.end());
+
+    out << "  \"recent_switches\": [";
+    for (auto i : range(recent.size())){
+      const auto& event = recent[i];
+      out << (i > 0 ? "," : "") << "\n    { \"dot\": " << event.dot
+        << ", \"frame\": " << event.dot / DotsPerFrame
+        << ", \"address\": " << event.address
+        << ", \"data\": " << u32(event.data)
+        << ", \"register\": " << u32(event.bank_register) << " }";
+    }
+    out << (recent.empty() ? "]\n" : "\n  ]\n");
+    out << "}\n";
+  }
+
+  static auto json_escape(const std::string& str) -> std::string{
+    auto escaped = std::string();
+    for (const auto c : str){
+      if (c == '"' || c == '\\') escaped += '\\';
+      escaped += c;
+    }
+    return escaped;
+  }
+};
+
+#ifdef NES_BANK_TRACE
+using BankTracePolicy = BankTrace;
+#else
+using BankTracePolicy = NoBankTrace;
+#endif
+
+} //namespace nes
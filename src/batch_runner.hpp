@@ -0,0 +1,117 @@
+#pragma once
+
+#include "aliases.hpp"
+#include "util.hpp"
+#include "nes.hpp"
+#include "thread_pool.hpp"
+#include <vector>
+#include <memory>
+#include <atomic>
+#include <chrono>
+#include <functional>
+
+namespace nes{
+
+//Hosts many Nes instances of one ROM, none with a window or audio device, and plays a list of
+//episodes on them. Instances advance in quanta of a few frames; every quantum is its own pool
+//task, so a core that runs out of work steals from the others and uneven episodes stay balanced
+struct BatchRunner{
+  static constexpr auto DefaultQuantum = 4;
+
+  //Called before every quantum with the episode and the frame it starts on, sets the controllers:
+  using input_t = std::function<void(u32 episode, u32 frame, Nes& nes)>;
+
+  //Called once an episode has run all of its frames:
+  using finish_t = std::function<void(u32 episode, Nes& nes)>;
+
+  struct Instance{
+    std::unique_ptr<Nes> nes;
+    u32 episode = 0;
+    u32 frame = 0;
+  };
+
+  struct Stats{
+    u64 frames = 0;
+    u32 episodes = 0;
+    double seconds = 0.0;
+
+    auto fps() const{
+      return seconds > 0.0 ? frames / seconds : 0.0;
+    }
+  };
+
+  std::shared_ptr<const RomImage> rom;
+  std::vector<Instance> instances;
+  ThreadPool& pool;
+  u32 quantum = DefaultQuantum;
+
+  BatchRunner(std::shared_ptr<const RomImage> rom, u32 instance_count, ThreadPool& pool)
+  : rom(std::move(rom)), instances(instance_count), pool(pool) {}
+
+  //Every episode starts from power-on with private, empty PRG-RAM, so runs are reproducible
+  auto reset(Instance& instance){
+    instance.nes = std::make_unique<Nes>();
+    instance.nes->load_cardridge(rom);
+    instance.frame = 0;
+  }
+
+  //An exception from an episode (an unsupported opcode, say) ends that instance and is rethrown
+  //here once the other instances have stopped
+  auto run(const std::vector<u32>& episode_frames, const input_t& on_quantum = {}, const finish_t& on_finish = {}) -> Stats{
+    auto next_episode = std::atomic<u32>(0);
+    auto frames = std::atomic<u64>(0);
+
+    //Takes the next unplayed episode, false once all are handed out:
+    const auto claim = [&](Instance& instance){
+      const auto episode = next_episode++;
+      if (episode >= episode_frames.size()) return false;
+
+      instance.episode = episode;
+      reset(instance);
+      return true;
+    };
+
+    std::function<void(Instance&)> step = [&](Instance& instance){
+      const auto length = episode_frames[instance.episode];
+      const auto count = std::min(quantum, length - instance.frame);
+
+      if (on_quantum){
+        on_quantum(instance.episode, instance.frame, *instance.nes);
+      }
+
+      for (auto i : range(count)){
+        instance.nes->run_frame();
+      }
+
+      instance.frame += count;
+      frames += count;
+
+      if (instance.frame == length){
+        if (on_finish){
+          on_finish(instance.episode, *instance.nes);
+        }
+
+        if (!claim(instance)) return;
+      }
+
+      pool.submit([&]{ step(instance); });
+    };
+
+    const auto start = std::chrono::steady_clock::now();
+
+    for (auto& instance : instances){
+      if (!claim(instance)) break;
+      pool.submit([&]{ step(instance); });
+    }
+
+    pool.wait();
+
+    auto stats = Stats();
+    stats.frames = frames;
+    stats.episodes = episode_frames.size();
+    stats.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    return stats;
+  }
+};
+
+} //namespace nes
@@ -0,0 +1,144 @@
+#pragma once
+
+#include "aliases.hpp"
+#include "util.hpp"
+#include <string>
+#include <vector>
+#include <fstream>
+#include <stdexcept>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace nes{
+
+//Cartridge PRG-RAM. With a save path on POSIX systems it is a shared mapping of the .sav file:
+//writes land in the page cache, the kernel writes them back in the background and progress
+//survives a crash of the emulator. Without a save path (or on Windows) it is plain memory,
+//and on Windows it is loaded from and written back to the .sav file
+struct BatteryRam{
+  u8* data = nullptr;
+  u32 size = 0;
+  std::string save_path;
+  std::vector<u8> buffer;
+  bool mapped = false;
+
+  BatteryRam() {}
+
+  BatteryRam(u32 size, const std::string& save_path = "") : size(size), save_path(save_path){
+    if (save_path.empty() || !map_file()){
+      load_buffer();
+    }
+  }
+
+  BatteryRam(const BatteryRam&) = delete;
+  auto operator=(const BatteryRam&) -> BatteryRam& = delete;
+
+  BatteryRam(BatteryRam&& other){
+    *this = std::move(other);
+  }
+
+  auto operator=(BatteryRam&& other) -> BatteryRam&{
+    if (this == &other) return *this;
+
+    release();
+
+    size = other.size;
+    save_path = std::move(other.save_path);
+    mapped = other.mapped;
+    buffer = std::move(other.buffer);
+    data = mapped ? other.data : buffer.data();
+
+    other.data = nullptr;
+    other.size = 0;
+    other.mapped = false;
+    other.save_path.clear();
+
+    return *this;
+  }
+
+  //Same contents in plain memory with no .sav behind it, so copies never write the save file
+  auto detached_copy() const{
+    auto copy = BatteryRam();
+    copy.size = size;
+    copy.buffer.assign(data, data + size);
+    copy.data = copy.buffer.data();
+
+    return copy;
+  }
+
+  auto bytes() const{
+    return Span<u8>(data, size);
+  }
+
+  auto map_file() -> bool{
+#ifdef _WIN32
+    return false;
+#else
+    const auto fd = ::open(save_path.c_str(), O_RDWR | O_CREAT, 0644);
+    if (fd < 0) return false;
+
+    struct stat info;
+    if (::fstat(fd, &info) != 0 || (info.st_size < size && ::ftruncate(fd, size) != 0)){
+      ::close(fd);
+      return false;
+    }
+
+    const auto mapping = ::mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    ::close(fd);
+
+    if (mapping == MAP_FAILED) return false;
+
+    data = static_cast<u8*>(mapping);
+    mapped = true;
+    return true;
+#endif
+  }
+
+  auto load_buffer() -> void{
+    buffer.assign(size, 0);
+    data = buffer.data();
+
+    if (save_path.empty()) return;
+
+    auto file = std::ifstream(save_path, std::ios::binary);
+    if (!file) return;
+
+    file.read(reinterpret_cast<char*>(buffer.data()), buffer.size());
+  }
+
+  //Schedules write-back without waiting for it
+  auto flush() -> void{
+#ifndef _WIN32
+    if (mapped){
+      ::msync(data, size, MS_ASYNC);
+    }
+#endif
+  }
+
+  auto release() -> void{
+#ifndef _WIN32
+    if (mapped){
+      flush();
+      ::munmap(data, size);
+    }
+#endif
+    if (!mapped && !save_path.empty() && data != nullptr){
+      auto file = std::ofstream(save_path, std::ios::binary);
+      file.write(reinterpret_cast<char*>(buffer.data()), buffer.size());
+    }
+
+    data = nullptr;
+    mapped = false;
+  }
+
+  ~BatteryRam(){
+    release();
+  }
+};
+
+} //namespace nes
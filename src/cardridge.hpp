@@ -5,147 +5,188 @@
 #include "util.hpp"
 #include <string>
 #include <vector>
-#include <fstream>
+#include "rom_image.hpp"
+#include "battery_ram.hpp"
+#include <variant>
 #include <memory>
 #include <optional>
 
 namespace nes{
 
-struct CardridgeHeader{
-  u8 name[4]; 
-  u8 program_rom_chunks;
-  u8 char_rom_chunks;
-  u8 mapper1;
-  u8 mapper2;
-  u8 program_ram_size;
-  u8 tv_system1;
-  u8 tv_system2;
-  u8 unused[5];
-};
+//Constructs the mapper 'header' asks for in place. Returns false for unsupported mappers
+inline auto make_mapper(MapperVariant& mapper, const CardridgeHeader& header) -> bool{
+  switch(header.mapper_id()){
+    case 0: 
+      mapper.emplace<Mapper000>(header.program_rom_chunks); break;
+    case 1: 
+      mapper.emplace<Mapper001>(header.program_rom_chunks, header.char_rom_chunks); break;
+    case 2:
+      mapper.emplace<Mapper002>(header.program_rom_chunks, header.char_rom_chunks); break;
+    case 3:
+      mapper.emplace<Mapper003>(header.program_rom_chunks, header.char_rom_chunks); break;
+    case 4:
+      mapper.emplace<Mapper004>(header.program_rom_chunks); break;
+    case 66:
+      mapper.emplace<Mapper066>(header.program_rom_chunks, header.char_rom_chunks); break;
+    default:
+      return false;
+  }
+
+  return true;
+}
+
+inline auto is_mapper_supported(const CardridgeHeader& header){
+  auto mapper = MapperVariant();
+  return make_mapper(mapper, header);
+}
 
 struct Cardridge{
+  static constexpr auto StaticRamSize = 8_kb;
+
+  //Shared with every other instance running the same image:
+  std::shared_ptr<const RomImage> rom;
   CardridgeHeader header;
-  std::vector<u8> program_memory;
-  std::vector<u8> char_memory;
-  std::unique_ptr<Mapper> mapper;
+  Span<const u8> program_memory;
+  Span<const u8> char_memory;
+
+  //Per instance, only allocated for carts without CHR-ROM:
+  std::vector<u8> char_ram;
+
+  //Per instance, backed by the .sav file when the cart has a battery and the host asked for it:
+  BatteryRam static_ram;
+
+  MapperVariant mapper;
+
+  //Base of the active mapper, its bank tables are read without visiting the variant:
+  Mapper* banks = nullptr;
+
+  Cardridge() {}
+
+  //The copy shares the ROM image and gets its own CHR-RAM, PRG-RAM and mapper registers:
+  Cardridge(const Cardridge& other)
+  : rom(other.rom), header(other.header), program_memory(other.program_memory), char_memory(other.char_memory),
+    char_ram(other.char_ram), static_ram(other.static_ram.detached_copy()), mapper(other.mapper){
+    if (other.banks == nullptr) return;
+
+    if (!char_ram.empty()){
+      char_memory = char_ram;
+    }
+
+    std::visit([&](auto& mapper){
+      mapper.rebind(char_memory, static_ram.bytes());
+      banks = &mapper;
+    }, mapper);
+  }
+
+  auto operator=(const Cardridge&) -> Cardridge& = delete;
 
   auto mapper_id() const{
-    return (header.mapper2 & 0b11110000) | (header.mapper1 >> 4);
+    return header.mapper_id();
   }
 
   auto mirroring() const{
-    if (mapper->mirroring() == Mapper::Mirroring::Hardware){
+    const auto mirroring = std::visit([](auto& mapper){ return mapper.mirroring(); }, this->mapper);
+
+    if (mirroring == Mapper::Mirroring::Hardware){
       return (header.mapper1 & 0x01) 
         ? Mapper::Mirroring::Vertical 
         : Mapper::Mirroring::Horizontal;
     }
 
-    return mapper->mirroring();
+    return mirroring;
   }
 
-  auto get_game_name(std::string filepath){
-    //Remove extension:
-    filepath.pop_back();
-    filepath.pop_back();
-    filepath.pop_back();
-    filepath.pop_back();
-
-    const auto slash_pos = filepath.rfind('/');
-
-    if (slash_pos == std::string::npos){
-      return filepath;
-    }
-    return filepath.substr(slash_pos);
+  auto irq_state() const{
+    return std::visit([](auto& mapper){ return mapper.irq_state(); }, mapper);
   }
 
-  auto from_file(const std::string& filepath){
-    auto file = file_open_for_reading(filepath, std::ios::binary);
-
-    file.read(reinterpret_cast<char*>(&header), sizeof(CardridgeHeader));
+  auto clock_irq_counter(){
+    std::visit([](auto& mapper){ mapper.clock_irq_counter(); }, mapper);
+  }
 
-    if (header.mapper1 & (1 << 2)){
-      file.seekg(512, std::ios_base::cur);
-    }
+  auto irq_edges_remaining() const{
+    return std::visit([](auto& mapper){ return mapper.irq_edges_remaining(); }, mapper);
+  }
 
-    const auto file_type = 1;
+  auto from_file(const std::string& filepath, bool persist_save = false){
+    attach(RomImage::load(filepath), persist_save);
+  }
 
-    if (file_type == 1){
-      program_memory.resize(header.program_rom_chunks * 16_kb);
-      file.read(reinterpret_cast<char*>(program_memory.data()), program_memory.size()); 
+  //Only the frontend persists battery RAM. Every other host gets private PRG-RAM, so instances of
+  //one ROM never see each other's writes and tool runs never touch the user's saves
+  auto attach(std::shared_ptr<const RomImage> rom, bool persist_save = false) -> void{
+    this->rom = std::move(rom);
+    header = this->rom->header;
+    program_memory = this->rom->program_rom;
 
-      if (header.char_rom_chunks == 0){
-        char_memory.resize(8_kb, 0);
-      }
-      else{
-        char_memory.resize(header.char_rom_chunks * 8_kb);
-        file.read(reinterpret_cast<char*>(char_memory.data()), char_memory.size()); 
-      }
+    if (header.char_rom_chunks == 0){
+      char_ram.assign(8_kb, 0);
+      char_memory = char_ram;
     }
     else{
-      throw std::runtime_error("Unsupported file type: " + std::to_string(file_type));
+      char_ram.clear();
+      char_memory = this->rom->char_rom;
     }
 
-    const auto game_name = get_game_name(filepath);
-    switch(mapper_id()){
-      case 0: 
-        mapper = std::make_unique<Mapper000>(header.program_rom_chunks); break;
-      case 1: 
-        mapper = std::make_unique<Mapper001>(game_name, header.program_rom_chunks, header.char_rom_chunks); break;
-      case 2:
-        mapper = std::make_unique<Mapper002>(header.program_rom_chunks, header.char_rom_chunks); break;
-      case 3:
-        mapper = std::make_unique<Mapper003>(header.program_rom_chunks, header.char_rom_chunks); break;
-      case 4:
-        mapper = std::make_unique<Mapper004>(game_name, header.program_rom_chunks); break;
-      case 66:
-        mapper = std::make_unique<Mapper066>(header.program_rom_chunks, header.char_rom_chunks); break;
-      default:
-        throw std::runtime_error("Unsupported mapper: " + std::to_string(mapper_id()));
+    static_ram = BatteryRam(StaticRamSize, persist_save && header.has_battery() ? this->rom->save_path : "");
+
+    if (!make_mapper(mapper, header)){
+      throw std::runtime_error("Unsupported mapper: " + std::to_string(mapper_id()));
     }
+
+    std::visit([&](auto& mapper){
+      mapper.attach(program_memory, char_memory, static_ram.bytes(), !char_ram.empty());
+      mapper.update_banks();
+      banks = &mapper;
+    }, mapper);
   }
 
-  auto cpu_write(u16 address, u8 value){
-    const auto mapped = mapper->cpu_write(address, value);
+  //Every access goes where the page classification says. ROM pages are never written, so the
+  //shared read-only image can't be corrupted by games writing to it
+  auto cpu_write(u16 address, u8 value) -> bool{
+    switch(banks->cpu_page(address).write){
+      case Mapper::PageKind::Ram:
+        static_ram.data[address & (StaticRamSize - 1)] = value;
+        return true;
 
-    if (mapped.used_cartridge_ram()) return true;
-    if (mapped.has_address()){
-      program_memory[mapped.address] = value;
-      return true;
-    }
+      case Mapper::PageKind::Register:
+        std::visit([&](auto& mapper){ mapper.cpu_write(address, value); }, mapper);
+        return true;
+
+      case Mapper::PageKind::Rom:
+        return true;
 
-    return false;
+      default:
+        return false;
+    }
   }
 
   auto cpu_read(u16 address) const -> std::optional<u8>{
-    const auto mapped = mapper->cpu_read(address);
+    switch(banks->cpu_page(address).read){
+      case Mapper::PageKind::Rom:
+        return banks->read_program(address);
 
-    if (mapped.used_cartridge_ram()){
-      return mapped.data;
-    }
+      case Mapper::PageKind::Ram:
+        return static_ram.data[address & (StaticRamSize - 1)];
 
-    if (mapped.has_address()){
-      return program_memory[mapped.address];
+      default:
+        return std::nullopt;
     }
-
-    return std::nullopt;
   }
 
   auto ppu_write(u16 address, u8 value) -> bool{
-    const auto mapped = mapper->ppu_write(address, value);
+    if (address >= 0x2000) return false;
 
-    if (mapped.has_address()){
-      char_memory[mapped.address] = value;
-      return true;
+    if (banks->char_page(address) == Mapper::PageKind::Ram){
+      char_ram[banks->char_offset(address)] = value;
     }
 
-    return false;
+    return true;
   }
 
   auto ppu_read(u16 address) const -> std::optional<u8>{
-    const auto mapped = mapper->ppu_read(address);
-
-    if (mapped.has_address()){
-      return char_memory[mapped.address];
+    if (address < 0x2000){
+      return banks->read_char(address);
     }
 
     return std::nullopt;
@@ -455,8 +455,9 @@ static auto rla(Cpu& cpu, Nes& nes) -> void{
   and_(cpu, nes);
 }
 
-Cpu::Cpu(){
-  auto& lookup = instruction_lookup;
+static auto make_instruction_lookup(){
+  using AddressMode = Cpu::AddressMode;
+  auto lookup = std::array<Cpu::Instruction, 16 * 16>();
 
   auto instruction = &ora;
   lookup[0x09] = { 2, AddressMode::Immediate, instruction };
@@ -852,8 +853,12 @@ Cpu::Cpu(){
       instruction.may_req_additional_cycle = true;
     }
   }
+
+  return lookup;
 }
 
+const std::array<Cpu::Instruction, 16 * 16> Cpu::instruction_lookup = make_instruction_lookup();
+
 auto Cpu::set_address_mode(Nes& nes, Cpu::AddressMode mode) -> bool{
   using Mode = Cpu::AddressMode;
   switch(mode){
@@ -1042,9 +1047,10 @@ static auto cpu_interrupt(Cpu& cpu, Nes& nes, u16 absolute_address){
 
   cpu.status.set(Cpu::Status::BreakCommand, 0);
   cpu.status.set(Cpu::Status::Unused, 1);
-  cpu.status.set(Cpu::Status::InterruptDisable, 1);
 
+  //The pushed status keeps the interrupt flag from before, so RTI re-enables IRQs:
   cpu.stack_push(nes, cpu.status.value);
+  cpu.status.set(Cpu::Status::InterruptDisable, 1);
 
   cpu.absolute_address = absolute_address;
   cpu.pc = nes.mem_read_u16(absolute_address);
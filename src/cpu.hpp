@@ -68,9 +68,9 @@ struct Cpu{
   bool next_instruction_started = true;
   u16 instruction_pc = 0;
 
-  std::array<Instruction, 16 * 16> instruction_lookup;
+  //Decode table shared by every instance, Cpu itself only holds registers:
+  static const std::array<Instruction, 16 * 16> instruction_lookup;
 
-  Cpu();
   auto set_address_mode(Nes& nes, Cpu::AddressMode mode) -> bool;
   
   //Read from address inside 'absolute_address' prop
@@ -0,0 +1,159 @@
+#pragma once
+
+#include "aliases.hpp"
+#include "util.hpp"
+#include "nes.hpp"
+#include "framebuffer.hpp"
+#include <memory>
+#include <string>
+#include <stdexcept>
+
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define NES_SSE2
+#endif
+
+namespace nes{
+
+//Box-filters 'factor' x 'factor' blocks of the frame into one greyscale byte each, writing rows of
+//width / factor bytes into 'output'. Columns and rows that don't fill a whole block are dropped
+inline auto greyscale_downsample(const Framebuffer& framebuffer, u32 factor, Span<u8> output) -> void{
+  static constexpr auto MaxFactor = 16;
+
+  if (factor == 0 || factor > MaxFactor){
+    throw std::runtime_error("Downsample factor must be between 1 and " + std::to_string(MaxFactor));
+  }
+
+  const auto width = u32(framebuffer.size.x);
+  const auto height = u32(framebuffer.size.y);
+  const auto output_width = width / factor;
+  const auto output_height = height / factor;
+
+  if (output.size() < output_width * output_height){
+    throw std::runtime_error("Observation buffer too small for the downsampled frame");
+  }
+
+  const auto pixels = framebuffer.bytes();
+  const auto row_bytes = width * 3;
+
+  //Channel sums of 'factor' rows, up to 16 * 255 so they fit in 16 bits:
+  auto sums = std::vector<u16>(row_bytes);
+
+  for (auto y : range(output_height)){
+    std::fill(sums.begin(), sums.end(), 0);
+
+    //Rows are added bytewise, channels never mix so this part needs no deinterleaving:
+    for (auto row_index : range(factor)){
+      const auto row = pixels.data() + (y * factor + row_index) * row_bytes;
+      auto x = u32(0);
+
+#ifdef NES_SSE2
+      const auto zero = _mm_setzero_si128();
+      for (; x + 16 <= row_bytes; x += 16){
+        const auto bytes = _mm_loadu_si128(reinterpret_cast<const __m128i*>(row + x));
+        const auto low = _mm_loadu_si128(reinterpret_cast<const __m128i*>(sums.data() + x));
+        const auto high = _mm_loadu_si128(reinterpret_cast<const __m128i*>(sums.data() + x + 8));
+
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(sums.data() + x), _mm_add_epi16(low, _mm_unpacklo_epi8(bytes, zero)));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(sums.data() + x + 8), _mm_add_epi16(high, _mm_unpackhi_epi8(bytes, zero)));
+      }
+#endif
+
+      for (; x < row_bytes; ++x){
+        sums[x] += row[x];
+      }
+    }
+
+    //BT.601 luma weights scaled to 256, applied once per block:
+    const auto divisor = 256 * factor * factor;
+    for (auto x : range(output_width)){
+      auto red = u32(0);
+      auto green = u32(0);
+      auto blue = u32(0);
+
+      for (auto column : range(factor)){
+        const auto sum = sums.data() + (x * factor + column) * 3;
+        red += sum[0];
+        green += sum[1];
+        blue += sum[2];
+      }
+
+      output[y * output_width + x] = (77 * red + 150 * green + 29 * blue) / divisor;
+    }
+  }
+}
+
+//Gym-style wrapper for agents: reset(), step() and observation() over one Nes instance
+struct Environment{
+  enum class Observation{
+    Ram,
+    Framebuffer
+  };
+
+  //Action bits, the low byte drives controller 1 and the high byte controller 2:
+  enum Button : u16{
+    Right = 1 << 0,
+    Left = 1 << 1,
+    Down = 1 << 2,
+    Up = 1 << 3,
+    Start = 1 << 4,
+    Select = 1 << 5,
+    B = 1 << 6,
+    A = 1 << 7
+  };
+
+  static constexpr auto Player2 = 8;
+
+  std::shared_ptr<const RomImage> rom;
+  std::unique_ptr<Nes> nes;
+  Observation observation_kind;
+  u64 frame = 0;
+
+  Environment(const std::string& rom_path, Observation observation_kind = Observation::Ram)
+  : rom(RomImage::load(rom_path)), observation_kind(observation_kind){
+    reset();
+  }
+
+  //Back to power-on. Spans returned earlier are invalidated
+  auto reset() -> Span<const u8>{
+    nes = std::make_unique<Nes>();
+    nes->load_cardridge(rom);
+    frame = 0;
+
+    return observation();
+  }
+
+  //Holds the buttons for 'frames' frames. Input is set once and nothing else happens between
+  //frames, so the per-step cost is spread over the whole frame skip
+  auto step(u16 action_bits, u32 frames = 1) -> Span<const u8>{
+    nes->controllers[0] = action_bits & 0xFF;
+    nes->controllers[1] = action_bits >> Player2;
+
+    for (auto i : range(frames)){
+      nes->run_frame();
+    }
+    frame += frames;
+
+    return observation();
+  }
+
+  //Views straight into the emulator, valid until the next step() or reset()
+  auto observation() const -> Span<const u8>{
+    return observation_kind == Observation::Ram ? ram() : framebuffer();
+  }
+
+  auto ram() const -> Span<const u8>{
+    return Span<const u8>(nes->ram.data(), Nes::CpuMemSize);
+  }
+
+  //Packed RGB, 3 bytes per pixel
+  auto framebuffer() const -> Span<const u8>{
+    return nes->finished_framebuffer.bytes();
+  }
+
+  auto downsample(u32 factor, Span<u8> output) const{
+    greyscale_downsample(nes->finished_framebuffer, factor, output);
+  }
+};
+
+} //namespace nes
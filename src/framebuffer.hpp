@@ -0,0 +1,45 @@
+#pragma once
+
+#include "aliases.hpp"
+#include "util.hpp"
+#include <vector>
+#include <algorithm>
+
+namespace nes{
+
+//CPU side RGB pixels the PPU draws into. Holds no GPU objects, so the core runs without a
+//window or GL context; the frontend uploads the finished frame into a Texture for display
+struct Framebuffer{
+  using pixel_color = vec<u8, 3>;
+
+  std::vector<pixel_color> pixels;
+  vec2 size = vec2(0.f);
+
+  Framebuffer(const vec2& size, bool visual_mode = true){
+    static_assert(sizeof(pixel_color) == 3);
+
+    if (!visual_mode) return;
+
+    this->size = size;
+    pixels.resize(size.x * size.y);
+  }
+
+  auto set_pixel(const vec2& position, const pixel_color& color){
+    const auto [x, y] = position;
+
+    if (!in_range(x, std::make_pair(0, size.x - 1))) return;
+    if (!in_range(y, std::make_pair(0, size.y - 1))) return;
+
+    pixels[y * size.x + x] = color;
+  }
+
+  auto clear(){
+    std::fill(pixels.begin(), pixels.end(), pixel_color(0, 0, 0));
+  }
+
+  auto bytes() const{
+    return Span<const u8>(reinterpret_cast<const u8*>(pixels.data()), pixels.size() * sizeof(pixel_color));
+  }
+};
+
+} //namespace nes
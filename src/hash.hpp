@@ -0,0 +1,189 @@
+#pragma once
+
+#include "aliases.hpp"
+#include "util.hpp"
+#include <array>
+#include <string>
+#include <cstring>
+#include <algorithm>
+
+namespace nes{
+
+//CRC-32 (IEEE, as used by No-Intro and zip), slicing-by-8: eight table lookups per 8 bytes
+//with no loop-carried dependency between them, so the lookups run in parallel
+struct Crc32{
+  std::array<std::array<u32, 256>, 8> tables;
+
+  Crc32(){
+    for (auto i : range(256)){
+      auto crc = u32(i);
+      for (auto bit : range(8)){
+        crc = (crc >> 1) ^ (0xEDB88320 & (0 - (crc & 1)));
+      }
+      tables[0][i] = crc;
+    }
+
+    for (auto i : range(256)){
+      for (auto slice : range(1, 8)){
+        const auto previous = tables[slice - 1][i];
+        tables[slice][i] = (previous >> 8) ^ tables[0][previous & 0xFF];
+      }
+    }
+  }
+
+  static auto get() -> const Crc32&{
+    static const auto crc = Crc32();
+    return crc;
+  }
+
+  auto update(u32 crc, const u8* data, std::size_t size) const{
+    crc = ~crc;
+
+    while (size >= 8){
+      u32 low, high;
+      std::memcpy(&low, data, 4);
+      std::memcpy(&high, data + 4, 4);
+      low = to_little_endian(low) ^ crc;
+      high = to_little_endian(high);
+
+      crc =
+        tables[7][low & 0xFF] ^ tables[6][(low >> 8) & 0xFF] ^
+        tables[5][(low >> 16) & 0xFF] ^ tables[4][low >> 24] ^
+        tables[3][high & 0xFF] ^ tables[2][(high >> 8) & 0xFF] ^
+        tables[1][(high >> 16) & 0xFF] ^ tables[0][high >> 24];
+
+      data += 8;
+      size -= 8;
+    }
+
+    while (size--){
+      crc = (crc >> 8) ^ tables[0][(crc ^ *data++) & 0xFF];
+    }
+
+    return ~crc;
+  }
+
+  static auto to_little_endian(u32 value) -> u32{
+    const auto bytes = reinterpret_cast<const u8*>(&value);
+    return u32(bytes[0]) | (u32(bytes[1]) << 8) | (u32(bytes[2]) << 16) | (u32(bytes[3]) << 24);
+  }
+};
+
+inline auto crc32(Span<const u8> data, u32 crc = 0){
+  return Crc32::get().update(crc, data.data(), data.size());
+}
+
+struct Sha1{
+  using digest_t = std::array<u8, 20>;
+
+  u32 state[5] = { 0x67452301, 0xEFCDAB89, 0x98BADCFE, 0x10325476, 0xC3D2E1F0 };
+  u8 block[64];
+  u32 block_size = 0;
+  u64 total_size = 0;
+
+  static auto rotate(u32 value, u32 bits){
+    return (value << bits) | (value >> (32 - bits));
+  }
+
+  auto process_block(const u8* data) -> void{
+    u32 w[80];
+    for (auto i : range(16)){
+      w[i] = (u32(data[i * 4]) << 24) | (u32(data[i * 4 + 1]) << 16) | (u32(data[i * 4 + 2]) << 8) | data[i * 4 + 3];
+    }
+    for (auto i : range(16, 80)){
+      w[i] = rotate(w[i - 3] ^ w[i - 8] ^ w[i - 14] ^ w[i - 16], 1);
+    }
+
+    auto a = state[0], b = state[1], c = state[2], d = state[3], e = state[4];
+
+    for (auto i : range(80)){
+      u32 f, k;
+      if (i < 20)      { f = (b & c) | (~b & d);          k = 0x5A827999; }
+      else if (i < 40) { f = b ^ c ^ d;                   k = 0x6ED9EBA1; }
+      else if (i < 60) { f = (b & c) | (b & d) | (c & d); k = 0x8F1BBCDC; }
+      else             { f = b ^ c ^ d;                   k = 0xCA62C1D6; }
+
+      const auto temp = rotate(a, 5) + f + e + k + w[i];
+      e = d;
+      d = c;
+      c = rotate(b, 30);
+      b = a;
+      a = temp;
+    }
+
+    state[0] += a;
+    state[1] += b;
+    state[2] += c;
+    state[3] += d;
+    state[4] += e;
+  }
+
+  auto update(const u8* data, std::size_t size){
+    total_size += size;
+
+    while (size > 0){
+      if (block_size == 0 && size >= 64){
+        process_block(data);
+        data += 64;
+        size -= 64;
+        continue;
+      }
+
+      const auto count = std::min<std::size_t>(64 - block_size, size);
+      std::memcpy(block + block_size, data, count);
+      block_size += count;
+      data += count;
+      size -= count;
+
+      if (block_size == 64){
+        process_block(block);
+        block_size = 0;
+      }
+    }
+  }
+
+  auto finish() -> digest_t{
+    const auto bit_size = total_size * 8;
+
+    const u8 padding = 0x80;
+    update(&padding, 1);
+
+    const u8 zero = 0;
+    while (block_size != 56){
+      update(&zero, 1);
+    }
+
+    u8 length[8];
+    for (auto i : range(8)){
+      length[i] = (bit_size >> (56 - i * 8)) & 0xFF;
+    }
+    update(length, 8);
+
+    auto digest = digest_t();
+    for (auto i : range(20)){
+      digest[i] = (state[i / 4] >> (24 - (i % 4) * 8)) & 0xFF;
+    }
+
+    return digest;
+  }
+};
+
+inline auto sha1(Span<const u8> data){
+  auto hasher = Sha1();
+  hasher.update(data.data(), data.size());
+  return hasher.finish();
+}
+
+inline auto hex_str(const u8* bytes, std::size_t size){
+  static constexpr char Digits[] = "0123456789abcdef";
+
+  auto str = std::string();
+  for (auto i : range(size)){
+    str += Digits[bytes[i] >> 4];
+    str += Digits[bytes[i] & 0x0F];
+  }
+
+  return str;
+}
+
+} //namespace nes
@@ -0,0 +1,275 @@
+#pragma once
+
+#include "aliases.hpp"
+#include "util.hpp"
+#include <array>
+#include <vector>
+#include <stdexcept>
+#include <cstdint>
+
+namespace nes{
+
+//Raw DEFLATE (RFC 1951) decoder. Huffman codes are decoded canonically, one length at a time,
+//which needs no lookup tables per block and is fast enough for ROM-sized members
+struct Inflate{
+  static constexpr auto MaxBits = 15;
+  static constexpr auto MaxLiteralCodes = 288;
+  static constexpr auto MaxDistanceCodes = 30;
+
+  struct Huffman{
+    std::array<u16, MaxBits + 1> count{};
+    std::array<u16, MaxLiteralCodes> symbol{};
+  };
+
+  Span<const u8> input;
+  std::size_t position = 0;
+  u32 bit_buffer = 0;
+  u32 bit_count = 0;
+
+  std::vector<u8>& output;
+
+  //Streams longer than this fail as soon as they get there, before they can allocate more:
+  std::size_t limit;
+
+  Inflate(Span<const u8> input, std::vector<u8>& output, std::size_t limit) : input(input), output(output), limit(limit) {}
+
+  //Decodes every block into 'output', failing when it would grow past 'limit' bytes. Returns the
+  //number of input bytes consumed
+  static auto decode(Span<const u8> input, std::vector<u8>& output, std::size_t limit = SIZE_MAX) -> std::size_t{
+    auto inflate = Inflate(input, output, limit);
+
+    auto last = false;
+    while(!last){
+      last = inflate.bits(1);
+
+      switch(inflate.bits(2)){
+        case 0: inflate.stored(); break;
+        case 1: inflate.codes(fixed_tables().first, fixed_tables().second); break;
+        case 2: inflate.dynamic(); break;
+        default: fail();
+      }
+    }
+
+    return inflate.position;
+  }
+
+  [[noreturn]] static auto fail() -> void{
+    throw std::runtime_error("Invalid deflate stream");
+  }
+
+  auto reserve(std::size_t length) -> void{
+    if (length > limit - output.size()) fail();
+  }
+
+  auto bits(u32 need) -> u32{
+    while (bit_count < need){
+      if (position >= input.size()) fail();
+
+      bit_buffer |= u32(input[position++]) << bit_count;
+      bit_count += 8;
+    }
+
+    const auto value = bit_buffer & ((1u << need) - 1);
+    bit_buffer >>= need;
+    bit_count -= need;
+
+    return value;
+  }
+
+  auto stored() -> void{
+    //Stored blocks start on a byte boundary:
+    bit_buffer = 0;
+    bit_count = 0;
+
+    if (position + 4 > input.size()) fail();
+
+    const auto length = input[position] | (input[position + 1] << 8);
+    const auto complement = input[position + 2] | (input[position + 3] << 8);
+    position += 4;
+
+    if (length != (~complement & 0xFFFF) || position + length > input.size()) fail();
+    reserve(length);
+
+    output.insert(output.end(), input.begin() + position, input.begin() + position + length);
+    position += length;
+  }
+
+  //Builds the canonical code from code lengths. Incomplete codes are allowed, decoding an unused
+  //code then fails in 'decode_symbol'
+  static auto construct(Huffman& huffman, const u16* lengths, u32 symbols) -> void{
+    huffman.count.fill(0);
+    for (auto i : range(symbols)){
+      huffman.count[lengths[i]]++;
+    }
+
+    auto left = 1;
+    for (auto length : range(1, MaxBits + 1)){
+      left = (left << 1) - huffman.count[length];
+      if (left < 0) fail();
+    }
+
+    std::array<u16, MaxBits + 1> offsets{};
+    for (auto length : range(1, MaxBits)){
+      offsets[length + 1] = offsets[length] + huffman.count[length];
+    }
+
+    for (auto i : range(symbols)){
+      if (lengths[i] != 0){
+        huffman.symbol[offsets[lengths[i]]++] = i;
+      }
+    }
+  }
+
+  auto decode_symbol(const Huffman& huffman) -> u32{
+    auto code = 0;
+    auto first = 0;
+    auto index = 0;
+
+    for (auto length : range(1, MaxBits + 1)){
+      code |= bits(1);
+      const auto count = huffman.count[length];
+
+      if (code - count < first){
+        return huffman.symbol[index + (code - first)];
+      }
+
+      index += count;
+      first += count;
+      first <<= 1;
+      code <<= 1;
+    }
+
+    fail();
+  }
+
+  auto codes(const Huffman& literals, const Huffman& distances) -> void{
+    static constexpr u16 LengthBase[] = {
+      3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31,
+      35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258
+    };
+    static constexpr u8 LengthExtra[] = {
+      0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2,
+      3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0
+    };
+    static constexpr u16 DistanceBase[] = {
+      1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193,
+      257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577
+    };
+    static constexpr u8 DistanceExtra[] = {
+      0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6,
+      7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13
+    };
+
+    while(true){
+      const auto symbol = decode_symbol(literals);
+
+      if (symbol < 256){
+        reserve(1);
+        output.push_back(symbol);
+        continue;
+      }
+
+      if (symbol == 256) return;
+
+      const auto length_code = symbol - 257;
+      if (length_code >= 29) fail();
+
+      const auto length = LengthBase[length_code] + bits(LengthExtra[length_code]);
+
+      const auto distance_code = decode_symbol(distances);
+      if (distance_code >= MaxDistanceCodes) fail();
+
+      const auto distance = DistanceBase[distance_code] + bits(DistanceExtra[distance_code]);
+      if (distance > output.size()) fail();
+      reserve(length);
+
+      //Byte by byte, the source may overlap what is being written:
+      auto from = output.size() - distance;
+      for (auto i : range(length)){
+        output.push_back(output[from + i]);
+      }
+    }
+  }
+
+  static auto fixed_tables() -> const std::pair<Huffman, Huffman>&{
+    static const auto tables = []{
+      auto tables = std::pair<Huffman, Huffman>();
+
+      u16 lengths[MaxLiteralCodes];
+      for (auto i : range(MaxLiteralCodes)){
+        lengths[i] = i < 144 ? 8 : i < 256 ? 9 : i < 280 ? 7 : 8;
+      }
+      construct(tables.first, lengths, MaxLiteralCodes);
+
+      for (auto i : range(MaxDistanceCodes)){
+        lengths[i] = 5;
+      }
+      construct(tables.second, lengths, MaxDistanceCodes);
+
+      return tables;
+    }();
+
+    return tables;
+  }
+
+  auto dynamic() -> void{
+    static constexpr u8 CodeLengthOrder[] = { 16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15 };
+
+    const auto literal_count = bits(5) + 257;
+    const auto distance_count = bits(5) + 1;
+    const auto code_length_count = bits(4) + 4;
+
+    if (literal_count > 286 || distance_count > MaxDistanceCodes) fail();
+
+    u16 lengths[MaxLiteralCodes + MaxDistanceCodes]{};
+    for (auto i : range(code_length_count)){
+      lengths[CodeLengthOrder[i]] = bits(3);
+    }
+
+    auto code_lengths = Huffman();
+    construct(code_lengths, lengths, 19);
+
+    auto index = u32(0);
+    while (index < literal_count + distance_count){
+      const auto symbol = decode_symbol(code_lengths);
+
+      if (symbol < 16){
+        lengths[index++] = symbol;
+        continue;
+      }
+
+      auto length = u16(0);
+      auto repeat = u32(0);
+
+      if (symbol == 16){
+        if (index == 0) fail();
+        length = lengths[index - 1];
+        repeat = 3 + bits(2);
+      }
+      else if (symbol == 17){
+        repeat = 3 + bits(3);
+      }
+      else{
+        repeat = 11 + bits(7);
+      }
+
+      if (index + repeat > literal_count + distance_count) fail();
+
+      while (repeat--){
+        lengths[index++] = length;
+      }
+    }
+
+    //Without an end-of-block code the block could never finish:
+    if (lengths[256] == 0) fail();
+
+    auto literals = Huffman();
+    auto distances = Huffman();
+    construct(literals, lengths, literal_count);
+    construct(distances, lengths + literal_count, distance_count);
+
+    codes(literals, distances);
+  }
+};
+
+} //namespace nes
@@ -0,0 +1,93 @@
+#pragma once
+
+#include "aliases.hpp"
+#include "util.hpp"
+#include <vector>
+#include <string>
+#include <fstream>
+#include <sstream>
+#include <algorithm>
+#include <stdexcept>
+
+namespace nes{
+
+//Controller input recorded per frame. Each line of a script is "<frame> <buttons>", the buttons
+//are held from that frame until the next line. Buttons are letters from "ABsSUDLR" (s = Select,
+//S = Start), '.' for none, or a hex byte prefixed with '$'. A second column of buttons sets
+//controller 2, '#' starts a comment
+struct InputScript{
+  static constexpr auto ButtonLetters = "ABsSUDLR";
+
+  struct Change{
+    u32 frame;
+    u8 buttons[2];
+  };
+
+  std::vector<Change> changes;
+
+  InputScript() = default;
+
+  InputScript(const std::string& filepath){
+    auto file = std::ifstream(filepath);
+    if (!file){
+      throw std::runtime_error("Unable to open input script: " + filepath);
+    }
+
+    auto line = std::string();
+    auto line_number = 0;
+
+    while (std::getline(file, line)){
+      line_number++;
+      line = line.substr(0, line.find('#'));
+
+      auto stream = std::istringstream(line);
+      auto frame = std::string();
+      if (!(stream >> frame)) continue;
+
+      auto change = Change{ 0, { 0, 0 } };
+      auto first = std::string();
+      auto second = std::string();
+      stream >> first >> second;
+
+      try{
+        change.frame = std::stoul(frame);
+        change.buttons[0] = parse_buttons(first);
+        change.buttons[1] = parse_buttons(second);
+      }
+      catch(const std::logic_error&){
+        throw std::runtime_error("Invalid input script line " + std::to_string(line_number) + ": " + filepath);
+      }
+
+      changes.push_back(change);
+    }
+
+    std::stable_sort(changes.begin(), changes.end(), [](const auto& a, const auto& b){ return a.frame < b.frame; });
+  }
+
+  //Bit 7 is A down to bit 0 for Right, the order the controller shifts them out
+  static auto parse_buttons(const std::string& text) -> u8{
+    if (text.empty() || text == ".") return 0;
+    if (text[0] == '$') return std::stoul(text.substr(1), nullptr, 16);
+
+    auto buttons = u8(0);
+    for (const auto c : text){
+      const auto letter = std::string(ButtonLetters).find(c);
+      if (letter == std::string::npos) throw std::invalid_argument("Unknown button");
+
+      buttons |= 0x80 >> letter;
+    }
+
+    return buttons;
+  }
+
+  //Buttons held during 'frame' on the given controller
+  auto buttons(u32 frame, u32 controller) const -> u8{
+    const auto next = std::upper_bound(changes.begin(), changes.end(), frame, [](u32 frame, const auto& change){
+      return frame < change.frame;
+    });
+
+    return next == changes.begin() ? 0 : std::prev(next)->buttons[controller];
+  }
+};
+
+} //namespace nes
@@ -0,0 +1,264 @@
+#pragma once
+
+#include "aliases.hpp"
+#include "util.hpp"
+#include "hash.hpp"
+#include "rom_image.hpp"
+#include "mapped_file.hpp"
+#include "cardridge.hpp"
+#include "thread_pool.hpp"
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <filesystem>
+#include <fstream>
+#include <algorithm>
+#include <cstring>
+
+namespace nes{
+
+//One indexed ROM. Plain data, so the whole index is a flat array that can be mapped straight
+//from disk without parsing
+struct LibraryEntry{
+  enum Flags : u32{
+    Valid = 1 << 0,
+    Nes2 = 1 << 1,
+    Supported = 1 << 2,
+    Battery = 1 << 3,
+    Trainer = 1 << 4,
+  };
+
+  i64 mtime;
+  u64 file_size;
+  u32 path_offset;
+  u32 path_length;
+
+  u32 program_crc32;
+  u32 char_crc32;
+  u8 program_sha1[20];
+  u8 char_sha1[20];
+
+  u32 program_rom_size;
+  u32 char_rom_size;
+  u32 program_ram_size;
+  u32 char_ram_size;
+  u16 mapper;
+  u8 submapper;
+  u8 timing;
+  u32 flags;
+
+  auto has(Flags flag) const{
+    return (flags & flag) > 0;
+  }
+};
+
+//Index file layout: LibraryIndexHeader, 'count' LibraryEntry records, then the string table
+//holding the (not null-terminated) paths the entries point into
+struct LibraryIndexHeader{
+  static constexpr u32 Magic = 0x5842494C; //"LIBX"
+  static constexpr u32 Version = 1;
+
+  u32 magic;
+  u32 version;
+  u32 count;
+  u32 entry_size;
+  u64 strings_offset;
+  u64 strings_size;
+};
+
+struct Library{
+  struct Item{
+    std::string path;
+    LibraryEntry entry;
+  };
+
+  std::vector<Item> items;
+
+  //Statistics of the last scan:
+  u32 hashed = 0;
+  u32 reused = 0;
+
+  static auto file_stamp(const std::filesystem::path& path, LibraryEntry& entry) -> bool{
+    auto error = std::error_code();
+
+    const auto size = std::filesystem::file_size(path, error);
+    if (error) return false;
+
+    const auto time = std::filesystem::last_write_time(path, error);
+    if (error) return false;
+
+    entry.file_size = size;
+    entry.mtime = time.time_since_epoch().count();
+    return true;
+  }
+
+  static auto index_rom(const std::string& path, LibraryEntry& entry) -> void{
+    try{
+      const auto rom = RomImage(path);
+      const auto& header = rom.header;
+
+      entry.program_crc32 = crc32(rom.program_rom);
+      entry.char_crc32 = crc32(rom.char_rom);
+
+      const auto program_sha1 = sha1(rom.program_rom);
+      const auto char_sha1 = sha1(rom.char_rom);
+      std::copy(program_sha1.begin(), program_sha1.end(), entry.program_sha1);
+      std::copy(char_sha1.begin(), char_sha1.end(), entry.char_sha1);
+
+      entry.program_rom_size = rom.program_rom.size();
+      entry.char_rom_size = rom.char_rom.size();
+      entry.program_ram_size = header.program_ram_bytes();
+      entry.char_ram_size = header.char_ram_bytes();
+      entry.mapper = header.mapper_id();
+      entry.submapper = header.submapper();
+      entry.timing = header.timing();
+
+      entry.flags |= LibraryEntry::Valid;
+      if (header.is_nes2()) entry.flags |= LibraryEntry::Nes2;
+      if (is_mapper_supported(header)) entry.flags |= LibraryEntry::Supported;
+      if (header.has_battery()) entry.flags |= LibraryEntry::Battery;
+      if (header.has_trainer()) entry.flags |= LibraryEntry::Trainer;
+    }
+    catch(const std::runtime_error&){
+      //Unreadable or truncated files stay in the index without the Valid flag
+    }
+  }
+
+  //Re-hashes only the files whose size or modification time changed since the last scan
+  auto scan(const std::string& directory, ThreadPool& pool){
+    auto previous = std::unordered_map<std::string, LibraryEntry>();
+    for (const auto& item : items){
+      previous[item.path] = item.entry;
+    }
+
+    items.clear();
+    hashed = 0;
+    reused = 0;
+
+    for (const auto& path : find_roms(directory)){
+      auto item = Item{ path, LibraryEntry() };
+      if (file_stamp(path, item.entry)){
+        items.push_back(std::move(item));
+      }
+    }
+
+    for (auto& item : items){
+      const auto found = previous.find(item.path);
+      if (found != previous.end() && found->second.mtime == item.entry.mtime && found->second.file_size == item.entry.file_size){
+        item.entry = found->second;
+        reused++;
+        continue;
+      }
+
+      hashed++;
+      pool.submit([&item]{ index_rom(item.path, item.entry); });
+    }
+
+    pool.wait();
+  }
+
+  static auto is_rom_file(const std::filesystem::path& path) -> bool{
+    return RomImage::has_rom_extension(path.string());
+  }
+
+  //ROM files under 'directory' in path order. Directories that can't be read and entries that
+  //can't be stat'ed are skipped, the walk goes on with their siblings
+  static auto find_roms(const std::string& directory) -> std::vector<std::string>{
+    auto paths = std::vector<std::string>();
+    find_roms(directory, paths);
+    std::sort(paths.begin(), paths.end());
+
+    return paths;
+  }
+
+  static auto find_roms(const std::filesystem::path& directory, std::vector<std::string>& paths) -> void{
+    auto error = std::error_code();
+    auto iter = std::filesystem::directory_iterator(directory, std::filesystem::directory_options::skip_permission_denied, error);
+
+    for (; !error && iter != std::filesystem::directory_iterator(); iter.increment(error)){
+      //Each entry gets its own error code, a failed stat must not end the walk:
+      auto entry_error = std::error_code();
+
+      //Symlinked directories aren't followed, so links can't make the walk loop:
+      if (iter->is_directory(entry_error) && !iter->is_symlink(entry_error)){
+        find_roms(iter->path(), paths);
+      }
+      else if (iter->is_regular_file(entry_error) && is_rom_file(iter->path())){
+        paths.push_back(iter->path().string());
+      }
+    }
+  }
+
+  auto save(const std::string& filepath) const{
+    auto strings = std::string();
+    auto entries = std::vector<LibraryEntry>();
+    entries.reserve(items.size());
+
+    for (const auto& item : items){
+      auto entry = item.entry;
+      entry.path_offset = strings.size();
+      entry.path_length = item.path.size();
+      strings += item.path;
+      entries.push_back(entry);
+    }
+
+    auto header = LibraryIndexHeader();
+    header.magic = LibraryIndexHeader::Magic;
+    header.version = LibraryIndexHeader::Version;
+    header.count = entries.size();
+    header.entry_size = sizeof(LibraryEntry);
+    header.strings_offset = sizeof(LibraryIndexHeader) + entries.size() * sizeof(LibraryEntry);
+    header.strings_size = strings.size();
+
+    //Written next to the index and renamed over it, so readers never map a half-written file
+    const auto temp_path = filepath + ".tmp";
+    {
+      auto file = std::ofstream(temp_path, std::ios::binary | std::ios::trunc);
+      if (!file){
+        throw std::runtime_error("Unable to write library index: " + filepath);
+      }
+
+      file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+      file.write(reinterpret_cast<const char*>(entries.data()), entries.size() * sizeof(LibraryEntry));
+      file.write(strings.data(), strings.size());
+    }
+
+    std::filesystem::rename(temp_path, filepath);
+  }
+
+  //A missing or stale index just leaves the library empty, the next scan rebuilds it
+  auto load(const std::string& filepath) -> bool{
+    items.clear();
+
+    auto error = std::error_code();
+    if (!std::filesystem::exists(filepath, error)) return false;
+
+    const auto file = MappedFile(filepath);
+    if (file.size < sizeof(LibraryIndexHeader)) return false;
+
+    auto header = LibraryIndexHeader();
+    std::memcpy(&header, file.data, sizeof(header));
+
+    if (header.magic != LibraryIndexHeader::Magic || header.version != LibraryIndexHeader::Version
+        || header.entry_size != sizeof(LibraryEntry)
+        || header.strings_offset != sizeof(header) + u64(header.count) * sizeof(LibraryEntry)
+        || header.strings_offset + header.strings_size > file.size){
+      return false;
+    }
+
+    const auto strings = reinterpret_cast<const char*>(file.data + header.strings_offset);
+
+    for (auto i : range(header.count)){
+      auto entry = LibraryEntry();
+      std::memcpy(&entry, file.data + sizeof(header) + i * sizeof(LibraryEntry), sizeof(entry));
+
+      if (u64(entry.path_offset) + entry.path_length > header.strings_size) return false;
+
+      items.push_back({ std::string(strings + entry.path_offset, entry.path_length), entry });
+    }
+
+    return true;
+  }
+};
+
+} //namespace nes
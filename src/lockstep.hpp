@@ -0,0 +1,775 @@
+#pragma once
+
+#include "aliases.hpp"
+#include "util.hpp"
+#include "nes.hpp"
+#include "hash.hpp"
+#include <array>
+#include <vector>
+#include <memory>
+#include <cstring>
+#include <stdexcept>
+
+namespace nes{
+
+//Runs 'Lanes' copies of one ROM in lockstep. The 6502 registers and the 2Kb of RAM are kept as
+//structure of arrays, one column per lane: at every CPU cycle the lanes fetching an instruction
+//are grouped by opcode and each group executes once, with the register and flag updates written
+//as blends over all lanes so the compiler turns them into vector code (build with -mavx2 or
+//-mavx512bw for wider vectors). Lanes that diverge simply end up in different groups.
+//PPU, APU, mapper and DMA state stay in one scalar Nes per lane, whose own Cpu and RAM are unused.
+//The result must match the scalar Nes exactly, frame by frame
+template<u32 Lanes>
+struct Lockstep{
+  static_assert(Lanes > 0 && Lanes <= 64, "Lane masks are 64 bits wide");
+
+  using mask_t = u64;
+
+  template<typename T>
+  using lanes_t = std::array<T, Lanes>;
+
+  enum Flag : u8{
+    Carry = 1,
+    Zero = (1 << 1),
+    InterruptDisable = (1 << 2),
+    DecimalMode = (1 << 3),
+    BreakCommand = (1 << 4),
+    Unused = (1 << 5),
+    Overflow = (1 << 6),
+    Negative = (1 << 7)
+  };
+
+  enum class Operation : u8{
+    Unsupported,
+    Adc, And, Asl, Bcc, Bcs, Beq, Bit, Bmi, Bne, Bpl, Brk, Bvc, Bvs, Clc, Cld, Cli, Clv,
+    Cmp, Cpx, Cpy, Dec, Dex, Dey, Eor, Inc, Inx, Iny, Jmp, Jsr, Lda, Ldx, Ldy, Lsr, Nop,
+    Ora, Pha, Php, Pla, Plp, Rol, Ror, Rti, Rts, Sbc, Sec, Sed, Sei, Sta, Stx, Sty,
+    Tax, Tay, Tsx, Txa, Txs, Tya,
+    Lax, Sax, Dcp, Isc, Slo, Sre, Rra, Rla
+  };
+
+  struct alignas(64) Registers{
+    lanes_t<u8> a{};
+    lanes_t<u8> x{};
+    lanes_t<u8> y{};
+    lanes_t<u8> sp{};
+    lanes_t<u8> p{};
+    lanes_t<u16> pc{};
+    lanes_t<u8> req_cycles{};
+  } cpu;
+
+  //Address major, so lanes reading the same variable read one contiguous row:
+  alignas(64) u8 ram[Nes::CpuMemSize][Lanes]{};
+
+  std::array<std::unique_ptr<Nes>, Lanes> lanes;
+  u32 cycles = 0;
+
+  //Scratch of the group being executed, 0xFF in 'active' for its lanes:
+  lanes_t<u8> active{};
+  lanes_t<u8> operand{};
+  lanes_t<u8> relative{};
+  lanes_t<u8> page_crossed{};
+  lanes_t<u16> address{};
+
+  Lockstep(){
+    const auto& lookup = Cpu::instruction_lookup;
+    for (auto opcode : range(256)){
+      if ((lookup[opcode].call_ptr != nullptr) != (operations()[opcode] != Operation::Unsupported)){
+        throw std::logic_error("Lockstep opcode table is out of date at " + hex_str(u8(opcode)));
+      }
+    }
+  }
+
+  static auto operations() -> const std::array<Operation, 256>&{
+    static const auto table = []{
+      using Op = Operation;
+      const std::pair<Operation, std::vector<u8>> groups[] = {
+        { Op::Ora, { 0x09, 0x05, 0x15, 0x0D, 0x1D, 0x19, 0x01, 0x11 } },
+        { Op::And, { 0x29, 0x25, 0x35, 0x2D, 0x3D, 0x39, 0x21, 0x31 } },
+        { Op::Eor, { 0x49, 0x45, 0x55, 0x4D, 0x5D, 0x59, 0x41, 0x51 } },
+        { Op::Adc, { 0x69, 0x65, 0x75, 0x6D, 0x7D, 0x79, 0x61, 0x71 } },
+        { Op::Sbc, { 0xE9, 0xE5, 0xF5, 0xED, 0xFD, 0xF9, 0xE1, 0xF1, 0xEB } },
+        { Op::Cmp, { 0xC9, 0xC5, 0xD5, 0xCD, 0xDD, 0xD9, 0xC1, 0xD1 } },
+        { Op::Lda, { 0xA9, 0xA5, 0xB5, 0xAD, 0xBD, 0xB9, 0xA1, 0xB1 } },
+        { Op::Sta, { 0x85, 0x95, 0x8D, 0x9D, 0x99, 0x81, 0x91 } },
+        { Op::Ldx, { 0xA2, 0xA6, 0xB6, 0xAE, 0xBE } },
+        { Op::Ldy, { 0xA0, 0xA4, 0xB4, 0xAC, 0xBC } },
+        { Op::Stx, { 0x86, 0x96, 0x8E } },
+        { Op::Sty, { 0x84, 0x94, 0x8C } },
+        { Op::Cpx, { 0xE0, 0xE4, 0xEC } },
+        { Op::Cpy, { 0xC0, 0xC4, 0xCC } },
+        { Op::Asl, { 0x0A, 0x06, 0x16, 0x0E, 0x1E } },
+        { Op::Lsr, { 0x4A, 0x46, 0x56, 0x4E, 0x5E } },
+        { Op::Rol, { 0x2A, 0x26, 0x36, 0x2E, 0x3E } },
+        { Op::Ror, { 0x6A, 0x66, 0x76, 0x6E, 0x7E } },
+        { Op::Inc, { 0xE6, 0xF6, 0xEE, 0xFE } },
+        { Op::Dec, { 0xC6, 0xD6, 0xCE, 0xDE } },
+        { Op::Bit, { 0x24, 0x2C } },
+        { Op::Jmp, { 0x4C, 0x6C } },
+        { Op::Jsr, { 0x20 } }, { Op::Rts, { 0x60 } }, { Op::Rti, { 0x40 } }, { Op::Brk, { 0x00 } },
+        { Op::Bcc, { 0x90 } }, { Op::Bcs, { 0xB0 } }, { Op::Beq, { 0xF0 } }, { Op::Bmi, { 0x30 } },
+        { Op::Bne, { 0xD0 } }, { Op::Bpl, { 0x10 } }, { Op::Bvc, { 0x50 } }, { Op::Bvs, { 0x70 } },
+        { Op::Clc, { 0x18 } }, { Op::Cld, { 0xD8 } }, { Op::Cli, { 0x58 } }, { Op::Clv, { 0xB8 } },
+        { Op::Sec, { 0x38 } }, { Op::Sed, { 0xF8 } }, { Op::Sei, { 0x78 } },
+        { Op::Inx, { 0xE8 } }, { Op::Iny, { 0xC8 } }, { Op::Dex, { 0xCA } }, { Op::Dey, { 0x88 } },
+        { Op::Tax, { 0xAA } }, { Op::Tay, { 0xA8 } }, { Op::Tsx, { 0xBA } },
+        { Op::Txa, { 0x8A } }, { Op::Txs, { 0x9A } }, { Op::Tya, { 0x98 } },
+        { Op::Pha, { 0x48 } }, { Op::Php, { 0x08 } }, { Op::Pla, { 0x68 } }, { Op::Plp, { 0x28 } },
+        { Op::Nop, {
+          0xEA, 0x04, 0x44, 0x64, 0x0C, 0x14, 0x34, 0x54, 0x74, 0xD4, 0xF4,
+          0x1A, 0x3A, 0x5A, 0x7A, 0xDA, 0xFA, 0x80, 0x82, 0x89, 0xC2, 0xE2,
+          0x1C, 0x3C, 0x5C, 0x7C, 0xDC, 0xFC
+        } },
+        { Op::Lax, { 0xA3, 0xA7, 0xAF, 0xB3, 0xB7, 0xBF } },
+        { Op::Sax, { 0x83, 0x87, 0x8F, 0x97 } },
+        { Op::Dcp, { 0xC3, 0xC7, 0xCF, 0xD3, 0xD7, 0xDB, 0xDF } },
+        { Op::Isc, { 0xE3, 0xE7, 0xEF, 0xF3, 0xF7, 0xFB, 0xFF } },
+        { Op::Rla, { 0x23, 0x27, 0x2F, 0x33, 0x37, 0x3B, 0x3F } },
+        { Op::Rra, { 0x63, 0x67, 0x6F, 0x73, 0x77, 0x7B, 0x7F } },
+        { Op::Slo, { 0x03, 0x07, 0x0F, 0x13, 0x17, 0x1B, 0x1F } },
+        { Op::Sre, { 0x43, 0x47, 0x4F, 0x53, 0x57, 0x5B, 0x5F } },
+      };
+
+      auto table = std::array<Operation, 256>();
+      table.fill(Op::Unsupported);
+
+      for (const auto& [operation, opcodes] : groups){
+        for (const auto opcode : opcodes){
+          table[opcode] = operation;
+        }
+      }
+
+      return table;
+    }();
+
+    return table;
+  }
+
+  //Every lane starts from power-on on the same ROM
+  auto load_cardridge(std::shared_ptr<const RomImage> rom) -> void{
+    for (auto lane : range(Lanes)){
+      lanes[lane] = std::make_unique<Nes>();
+      lanes[lane]->load_cardridge(rom);
+
+      const auto& scalar = lanes[lane]->cpu;
+      cpu.a[lane] = scalar.accumulator;
+      cpu.x[lane] = scalar.x;
+      cpu.y[lane] = scalar.y;
+      cpu.sp[lane] = scalar.sp;
+      cpu.p[lane] = scalar.status.value;
+      cpu.pc[lane] = scalar.pc;
+      cpu.req_cycles[lane] = scalar.req_cycles;
+    }
+
+    std::memset(ram, 0, sizeof(ram));
+    cycles = 0;
+  }
+
+  auto load_cardridge(const std::string& filepath){
+    load_cardridge(RomImage::load(filepath));
+  }
+
+  static auto has(mask_t mask, u32 lane) -> bool{
+    return (mask >> lane) & 1;
+  }
+
+  template<typename Callable>
+  static auto for_each_lane(mask_t mask, Callable callable){
+    for (auto lane : range(Lanes)){
+      if (has(mask, lane)) callable(lane);
+    }
+  }
+
+  static auto blend(u8 mask, u8 value, u8 previous) -> u8{
+    return (value & mask) | (previous & ~mask);
+  }
+
+  static auto with_zero_negative(u8 status, u8 value) -> u8{
+    return (status & ~(Zero | Negative)) | (value == 0 ? Zero : 0) | (value & Negative);
+  }
+
+  //Memory, RAM is read from the columns and everything else from the lane's own bus:
+  auto read(u32 lane, u16 address) -> u8{
+    if (address < 0x2000) return ram[address & (Nes::CpuMemSize - 1)][lane];
+    return lanes[lane]->mem_read(address);
+  }
+
+  auto read_u16(u32 lane, u16 address) -> u16{
+    const auto low = read(lane, address);
+    const auto high = read(lane, address + 1);
+    return make_u16(high, low);
+  }
+
+  auto write(u32 lane, u16 address, u8 value){
+    if (address < 0x2000){
+      ram[address & (Nes::CpuMemSize - 1)][lane] = value;
+      return;
+    }
+
+    lanes[lane]->mem_write(address, value);
+  }
+
+  auto push(u32 lane, u8 value){
+    write(lane, Cpu::StackEnd + cpu.sp[lane], value);
+    cpu.sp[lane]--;
+  }
+
+  auto pull(u32 lane) -> u8{
+    cpu.sp[lane]++;
+    return read(lane, Cpu::StackEnd + cpu.sp[lane]);
+  }
+
+  //Group helpers, only lanes of the current group change:
+  auto load(mask_t group){
+    for_each_lane(group, [&](u32 lane){ operand[lane] = read(lane, address[lane]); });
+  }
+
+  auto store(mask_t group, const lanes_t<u8>& values){
+    for_each_lane(group, [&](u32 lane){ write(lane, address[lane], values[lane]); });
+  }
+
+  auto assign(lanes_t<u8>& target, const lanes_t<u8>& values){
+    for (auto lane : range(Lanes)){
+      target[lane] = blend(active[lane], values[lane], target[lane]);
+    }
+  }
+
+  auto set_zero_negative(const lanes_t<u8>& values){
+    for (auto lane : range(Lanes)){
+      cpu.p[lane] = blend(active[lane], with_zero_negative(cpu.p[lane], values[lane]), cpu.p[lane]);
+    }
+  }
+
+  auto set_flag(Flag flag, bool value){
+    for (auto lane : range(Lanes)){
+      const auto status = value ? (cpu.p[lane] | flag) : (cpu.p[lane] & ~flag);
+      cpu.p[lane] = blend(active[lane], status, cpu.p[lane]);
+    }
+  }
+
+  auto transfer(lanes_t<u8>& target, const lanes_t<u8>& source){
+    assign(target, source);
+    set_zero_negative(target);
+  }
+
+  auto add_with_carry(const lanes_t<u8>& values){
+    for (auto lane : range(Lanes)){
+      const auto accumulator = cpu.a[lane];
+      const auto value = values[lane];
+      const auto result = u16(accumulator + value + (cpu.p[lane] & Carry));
+      const auto overflow = ((value ^ result) & (accumulator ^ result) & 0x80) ? Overflow : 0;
+
+      const auto status = (cpu.p[lane] & ~(Carry | Zero | Overflow | Negative))
+        | (result > 0xFF ? Carry : 0) | ((result & 0xFF) == 0 ? Zero : 0) | overflow | (result & Negative);
+
+      cpu.p[lane] = blend(active[lane], status, cpu.p[lane]);
+      cpu.a[lane] = blend(active[lane], u8(result), accumulator);
+    }
+  }
+
+  auto subtract_with_carry(){
+    auto inverted = lanes_t<u8>();
+    for (auto lane : range(Lanes)){
+      inverted[lane] = ~operand[lane];
+    }
+    add_with_carry(inverted);
+  }
+
+  auto compare(const lanes_t<u8>& registers){
+    for (auto lane : range(Lanes)){
+      const auto value = operand[lane];
+      const auto reg = registers[lane];
+
+      const auto status = (cpu.p[lane] & ~(Carry | Zero | Negative))
+        | (value <= reg ? Carry : 0) | (value == reg ? Zero : 0) | (u8(reg - value) & Negative);
+
+      cpu.p[lane] = blend(active[lane], status, cpu.p[lane]);
+    }
+  }
+
+  auto logic(Operation operation){
+    auto result = lanes_t<u8>();
+    for (auto lane : range(Lanes)){
+      result[lane] = operation == Operation::And ? cpu.a[lane] & operand[lane]
+        : operation == Operation::Eor ? cpu.a[lane] ^ operand[lane]
+        : cpu.a[lane] | operand[lane];
+    }
+    transfer(cpu.a, result);
+  }
+
+  //ASL, LSR, ROL and ROR on 'operand', the result is left in 'operand'
+  auto shift(Operation operation){
+    for (auto lane : range(Lanes)){
+      const auto value = operand[lane];
+      const auto carry_in = cpu.p[lane] & Carry;
+
+      auto result = u8(0);
+      auto carry_out = u8(0);
+
+      switch(operation){
+        case Operation::Asl: result = value << 1; carry_out = value >> 7; break;
+        case Operation::Lsr: result = value >> 1; carry_out = value & 1; break;
+        case Operation::Rol: result = (value << 1) | carry_in; carry_out = value >> 7; break;
+        default: result = (value >> 1) | (carry_in << 7); carry_out = value & 1; break;
+      }
+
+      const auto status = with_zero_negative((cpu.p[lane] & ~Carry) | carry_out, result);
+      cpu.p[lane] = blend(active[lane], status, cpu.p[lane]);
+      operand[lane] = blend(active[lane], result, value);
+    }
+  }
+
+  auto read_modify_write(mask_t group, Operation operation){
+    load(group);
+    shift(operation);
+    store(group, operand);
+  }
+
+  auto increment(mask_t group, i32 delta){
+    load(group);
+    for (auto lane : range(Lanes)){
+      operand[lane] += delta;
+    }
+    store(group, operand);
+    set_zero_negative(operand);
+  }
+
+  auto branch(mask_t group, Flag flag, bool set){
+    for_each_lane(group, [&](u32 lane){
+      if (((cpu.p[lane] & flag) != 0) != set) return;
+
+      auto& pc = cpu.pc[lane];
+      cpu.req_cycles[lane]++;
+
+      auto target = u16(pc + relative[lane]);
+      if (relative[lane] > 127) target -= 256;
+
+      if ((pc & 0xFF00) != (target & 0xFF00)) cpu.req_cycles[lane]++;
+      pc = target;
+    });
+  }
+
+  auto interrupt(u32 lane, u16 vector){
+    auto& pc = cpu.pc[lane];
+    push(lane, (pc >> 8) & 0xFF);
+    push(lane, pc & 0xFF);
+
+    cpu.p[lane] = (cpu.p[lane] & ~BreakCommand) | Unused;
+    push(lane, cpu.p[lane]);
+    cpu.p[lane] |= InterruptDisable;
+
+    pc = read_u16(lane, vector);
+    cpu.req_cycles[lane] = 7;
+  }
+
+  //Same reads, in the same order, as Cpu::set_address_mode
+  auto resolve_address(mask_t group, Cpu::AddressMode mode){
+    using Mode = Cpu::AddressMode;
+
+    for_each_lane(group, [&](u32 lane){
+      auto& pc = cpu.pc[lane];
+      page_crossed[lane] = false;
+
+      switch(mode){
+        case Mode::Immediate:
+          address[lane] = pc++;
+          break;
+
+        case Mode::ZeroPage:
+          address[lane] = read(lane, pc++) & 0x00FF;
+          break;
+
+        case Mode::ZeroPageX:
+          address[lane] = (read(lane, pc++) + cpu.x[lane]) & 0x00FF;
+          break;
+
+        case Mode::ZeroPageY:
+          address[lane] = (read(lane, pc++) + cpu.y[lane]) & 0x00FF;
+          break;
+
+        case Mode::Relative:
+          relative[lane] = read(lane, pc++);
+          break;
+
+        case Mode::Absolute:
+          address[lane] = read_u16(lane, pc);
+          pc += 2;
+          break;
+
+        case Mode::AbsoluteX:
+        case Mode::AbsoluteY:{
+          const auto base = read_u16(lane, pc);
+          address[lane] = base + (mode == Mode::AbsoluteX ? cpu.x[lane] : cpu.y[lane]);
+          page_crossed[lane] = (address[lane] & 0xFF00) != (base & 0xFF00);
+          pc += 2;
+          break;
+        }
+
+        case Mode::Indirect:{
+          const auto pointer = read_u16(lane, pc);
+          const auto low = read(lane, pointer);
+          const auto high = (pointer & 0x00FF) == 0x00FF ? read(lane, pointer & 0xFF00) : read(lane, pointer + 1);
+
+          pc += 2;
+          address[lane] = make_u16(high, low);
+          break;
+        }
+
+        case Mode::XIndirect:{
+          const auto pointer = read(lane, pc);
+          const auto low = read(lane, u16(pointer + cpu.x[lane]) & 0x00FF);
+          const auto high = read(lane, u16(pointer + cpu.x[lane] + 1) & 0x00FF);
+
+          address[lane] = make_u16(high, low);
+          pc++;
+          break;
+        }
+
+        case Mode::IndirectY:{
+          const auto pointer = read(lane, pc);
+          const u8 low = read(lane, u16(pointer) & 0x00FF);
+          const u8 high = read(lane, u16(pointer + 1) & 0x00FF);
+
+          address[lane] = make_u16(high, low) + cpu.y[lane];
+          page_crossed[lane] = (address[lane] & 0xFF00) != (high << 8);
+          pc++;
+          break;
+        }
+
+        default:
+          break;
+      }
+    });
+  }
+
+  auto execute(u8 opcode, mask_t group) -> void{
+    using Op = Operation;
+
+    //Address modes and cycle counts come from the scalar CPU's table:
+    const auto& instruction = Cpu::instruction_lookup[opcode];
+    const auto operation = operations()[opcode];
+
+    for (auto lane : range(Lanes)){
+      active[lane] = has(group, lane) ? 0xFF : 0x00;
+    }
+
+    if (operation == Op::Unsupported){
+      for_each_lane(group, [&](u32 lane){
+        throw std::runtime_error(hex_str(u16(cpu.pc[lane] - 1)) + " Unsupported opcode: " + hex_str(opcode));
+      });
+    }
+
+    resolve_address(group, instruction.address_mode);
+
+    for_each_lane(group, [&](u32 lane){
+      cpu.req_cycles[lane] = instruction.req_cycles + (instruction.may_req_additional_cycle && page_crossed[lane]);
+    });
+
+    const auto accumulator_addressing = instruction.address_mode == Cpu::AddressMode::Accumulator;
+
+    switch(operation){
+      case Op::Lda: load(group); transfer(cpu.a, operand); break;
+      case Op::Ldx: load(group); transfer(cpu.x, operand); break;
+      case Op::Ldy: load(group); transfer(cpu.y, operand); break;
+      case Op::Lax: load(group); transfer(cpu.a, operand); transfer(cpu.x, operand); break;
+
+      case Op::Sta: store(group, cpu.a); break;
+      case Op::Stx: store(group, cpu.x); break;
+      case Op::Sty: store(group, cpu.y); break;
+
+      case Op::Sax:{
+        auto values = lanes_t<u8>();
+        for (auto lane : range(Lanes)){
+          values[lane] = cpu.a[lane] & cpu.x[lane];
+        }
+        store(group, values);
+        break;
+      }
+
+      case Op::Tax: transfer(cpu.x, cpu.a); break;
+      case Op::Tay: transfer(cpu.y, cpu.a); break;
+      case Op::Tsx: transfer(cpu.x, cpu.sp); break;
+      case Op::Txa: transfer(cpu.a, cpu.x); break;
+      case Op::Tya: transfer(cpu.a, cpu.y); break;
+      case Op::Txs: assign(cpu.sp, cpu.x); break;
+
+      case Op::And:
+      case Op::Eor:
+      case Op::Ora:
+        load(group);
+        logic(operation);
+        break;
+
+      case Op::Adc: load(group); add_with_carry(operand); break;
+      case Op::Sbc: load(group); subtract_with_carry(); break;
+
+      case Op::Cmp: load(group); compare(cpu.a); break;
+      case Op::Cpx: load(group); compare(cpu.x); break;
+      case Op::Cpy: load(group); compare(cpu.y); break;
+
+      case Op::Bit:
+        load(group);
+        for (auto lane : range(Lanes)){
+          const auto value = operand[lane];
+          const auto status = (cpu.p[lane] & ~(Zero | Overflow | Negative))
+            | ((cpu.a[lane] & value) == 0 ? Zero : 0) | (value & (Overflow | Negative));
+
+          cpu.p[lane] = blend(active[lane], status, cpu.p[lane]);
+        }
+        break;
+
+      case Op::Inc: increment(group, 1); break;
+      case Op::Dec: increment(group, -1); break;
+
+      case Op::Inx:
+      case Op::Iny:
+      case Op::Dex:
+      case Op::Dey:{
+        auto& target = operation == Op::Inx || operation == Op::Dex ? cpu.x : cpu.y;
+        const auto delta = operation == Op::Inx || operation == Op::Iny ? 1 : -1;
+
+        auto values = lanes_t<u8>();
+        for (auto lane : range(Lanes)){
+          values[lane] = target[lane] + delta;
+        }
+        transfer(target, values);
+        break;
+      }
+
+      case Op::Asl:
+      case Op::Lsr:
+      case Op::Rol:
+      case Op::Ror:
+        if (accumulator_addressing){
+          operand = cpu.a;
+          shift(operation);
+          assign(cpu.a, operand);
+        }
+        else{
+          read_modify_write(group, operation);
+        }
+        break;
+
+      //Combined illegal opcodes read their operand again after writing it, like Cpu does:
+      case Op::Dcp: increment(group, -1); load(group); compare(cpu.a); break;
+      case Op::Isc: increment(group, 1); load(group); subtract_with_carry(); break;
+      case Op::Slo: read_modify_write(group, Op::Asl); load(group); logic(Op::Ora); break;
+      case Op::Sre: read_modify_write(group, Op::Lsr); load(group); logic(Op::Eor); break;
+      case Op::Rla: read_modify_write(group, Op::Rol); load(group); logic(Op::And); break;
+      case Op::Rra: read_modify_write(group, Op::Ror); load(group); add_with_carry(operand); break;
+
+      case Op::Bcc: branch(group, Carry, false); break;
+      case Op::Bcs: branch(group, Carry, true); break;
+      case Op::Bne: branch(group, Zero, false); break;
+      case Op::Beq: branch(group, Zero, true); break;
+      case Op::Bpl: branch(group, Negative, false); break;
+      case Op::Bmi: branch(group, Negative, true); break;
+      case Op::Bvc: branch(group, Overflow, false); break;
+      case Op::Bvs: branch(group, Overflow, true); break;
+
+      case Op::Clc: set_flag(Carry, false); break;
+      case Op::Cld: set_flag(DecimalMode, false); break;
+      case Op::Cli: set_flag(InterruptDisable, false); break;
+      case Op::Clv: set_flag(Overflow, false); break;
+      case Op::Sec: set_flag(Carry, true); break;
+      case Op::Sed: set_flag(DecimalMode, true); break;
+      case Op::Sei: set_flag(InterruptDisable, true); break;
+
+      case Op::Jmp:
+        for_each_lane(group, [&](u32 lane){ cpu.pc[lane] = address[lane]; });
+        break;
+
+      case Op::Jsr:
+        for_each_lane(group, [&](u32 lane){
+          const auto pc = u16(cpu.pc[lane] - 1);
+          push(lane, (pc >> 8) & 0xFF);
+          push(lane, pc & 0xFF);
+          cpu.pc[lane] = address[lane];
+        });
+        break;
+
+      case Op::Rts:
+        for_each_lane(group, [&](u32 lane){
+          const auto low = pull(lane);
+          const auto high = pull(lane);
+          cpu.pc[lane] = make_u16(high, low) + 1;
+        });
+        break;
+
+      case Op::Rti:
+        for_each_lane(group, [&](u32 lane){
+          cpu.p[lane] = pull(lane) & ~BreakCommand;
+          const auto low = pull(lane);
+          const auto high = pull(lane);
+          cpu.pc[lane] = make_u16(high, low);
+        });
+        break;
+
+      //Cpu pushes the high byte shifted out of a u8, so it is always 0:
+      case Op::Brk:
+        for_each_lane(group, [&](u32 lane){
+          cpu.p[lane] |= BreakCommand;
+          push(lane, 0);
+          push(lane, cpu.pc[lane] & 0xFF);
+          push(lane, cpu.p[lane]);
+          cpu.pc[lane] = read(lane, 0xFFFE) | u16(read(lane, 0xFFFF) << 8);
+        });
+        break;
+
+      case Op::Pha:
+        for_each_lane(group, [&](u32 lane){ push(lane, cpu.a[lane]); });
+        break;
+
+      case Op::Php:
+        for_each_lane(group, [&](u32 lane){ push(lane, cpu.p[lane] | Unused | BreakCommand); });
+        break;
+
+      case Op::Pla:
+        for_each_lane(group, [&](u32 lane){ operand[lane] = pull(lane); });
+        transfer(cpu.a, operand);
+        break;
+
+      case Op::Plp:
+        for_each_lane(group, [&](u32 lane){ cpu.p[lane] = pull(lane) & ~BreakCommand; });
+        break;
+
+      case Op::Nop:
+      case Op::Unsupported:
+        break;
+    }
+  }
+
+  //Nes::cpu_clock's OAM DMA, for one lane
+  auto dma_clock(u32 lane){
+    auto& nes = *lanes[lane];
+
+    if (nes.dma_dummy_cycle){
+      if (cycles % 2 == 1){
+        nes.dma_dummy_cycle = false;
+        return;
+      }
+    }
+
+    if (cycles % 2 == 0){
+      nes.dma_data = read(lane, nes.dma_page << 8 | nes.dma_address);
+    }
+    else{
+      reinterpret_cast<u8*>(nes.ppu.oam)[nes.dma_address] = nes.dma_data;
+      nes.dma_address++;
+
+      if (nes.dma_address == 0){
+        nes.dma_transfer_started = false;
+        nes.dma_dummy_cycle = true;
+      }
+    }
+  }
+
+  auto cpu_clock(){
+    auto fetching = mask_t(0);
+    auto running = mask_t(0);
+    auto opcodes = lanes_t<u8>();
+
+    for (auto lane : range(Lanes)){
+      if (lanes[lane]->dma_transfer_started){
+        dma_clock(lane);
+        continue;
+      }
+
+      running |= mask_t(1) << lane;
+      if (cpu.req_cycles[lane] == 0){
+        fetching |= mask_t(1) << lane;
+        opcodes[lane] = read(lane, cpu.pc[lane]);
+        cpu.pc[lane]++;
+      }
+    }
+
+    //One pass per distinct opcode:
+    auto remaining = fetching;
+    while (remaining != 0){
+      auto first = u32(0);
+      while (!has(remaining, first)) first++;
+
+      auto group = mask_t(0);
+      for_each_lane(remaining, [&](u32 lane){
+        if (opcodes[lane] == opcodes[first]) group |= mask_t(1) << lane;
+      });
+
+      execute(opcodes[first], group);
+      remaining &= ~group;
+    }
+
+    for_each_lane(fetching, [&](u32 lane){ cpu.p[lane] |= Unused; });
+    for_each_lane(running, [&](u32 lane){ cpu.req_cycles[lane]--; });
+  }
+
+  auto poll_irq(u32 lane){
+    auto& nes = *lanes[lane];
+
+    if (nes.cardridge.irq_state()){
+      if ((cpu.p[lane] & InterruptDisable) == 0){
+        interrupt(lane, 0xFFFE);
+      }
+      nes.irq_dot = nes.ppu.dot;
+      return;
+    }
+
+    const auto edge_dot = nes.ppu.a12_edge_dot(nes.cardridge.irq_edges_remaining());
+    nes.irq_dot = edge_dot == Ppu::NeverDot ? edge_dot : edge_dot + 1;
+  }
+
+  //Nes::clock for every lane, without audio
+  auto clock(){
+    for (auto& nes : lanes){
+      nes->apu.clock();
+      nes->ppu.clock(*nes);
+    }
+
+    if (cycles % 3 == 0){
+      cpu_clock();
+    }
+
+    for (auto lane : range(Lanes)){
+      auto& nes = *lanes[lane];
+
+      if (nes.ppu.nmi){
+        nes.nmi_pc = cpu.pc[lane];
+        nes.ppu.nmi = false;
+        interrupt(lane, 0xFFFA);
+      }
+
+      if (nes.ppu.dot >= nes.irq_dot){
+        poll_irq(lane);
+      }
+    }
+
+    cycles++;
+  }
+
+  //The PPUs run in lockstep too, so every lane finishes its frame on the same dot
+  auto run_frame(){
+    while (!lanes[0]->ppu.frame_complete){
+      clock();
+    }
+
+    for (auto& nes : lanes){
+      nes->ppu.frame_complete = false;
+    }
+  }
+
+  auto lane_ram(u32 lane) const{
+    auto column = std::array<u8, Nes::CpuMemSize>();
+    for (auto address : range(Nes::CpuMemSize)){
+      column[address] = ram[address][lane];
+    }
+    return column;
+  }
+
+  //Same hash as Nes::frame_hash
+  auto frame_hash(u32 lane) const{
+    const auto crc = crc32(lanes[lane]->finished_framebuffer.bytes());
+    const auto column = lane_ram(lane);
+    return crc32(Span<const u8>(column.data(), column.size()), crc);
+  }
+};
+
+} //namespace nes
@@ -4,6 +4,7 @@
 #include "debugger.hpp"
 
 #include <iostream>
+#include <fstream>
 #include <cassert>
 
 static constexpr auto Viewport = gf::math::vec2(
@@ -14,7 +15,7 @@ static constexpr auto Viewport = gf::math::vec2(
 auto main(int argc, char** argv) -> int{
   auto rom_path = std::string();
   if (argc < 2){
-    std::cout << "Enter ROM path (without .nes extension): ";
+    std::cout << "Enter ROM path (.nes extension optional): ";
     std::cin >> rom_path;
   }
   else{
@@ -39,32 +40,30 @@ auto main(int argc, char** argv) -> int{
 
 
   nes::Nes nes;
-  nes.load_cardridge(rom_path + ".nes");
+  if (!nes::RomImage::has_rom_extension(rom_path)){
+    rom_path += ".nes";
+  }
+  nes.load_cardridge(rom_path, nes::Nes::PersistSave);
   nes::Renderer renderer(Viewport);
   nes::Debugger debugger;
 
+  auto screen = nes::Texture(nes::Ppu::ScreenSize);
+  screen.scale = nes::vec2(2.f);
+
   window.show();
   auto delta_time = 0.f;
 
-  nes.apu.play([&](nes::Nes& nes) -> float{
-    static auto time = 0.0;
-
-    if (nes.paused) return 0.f;
+  const auto low_latency = argc > 2 && std::string(argv[2]) == "--low-latency";
+  nes::AudioPlayer<nes::Nes> sound(
+    nes::Nes::AudioSampleRate, 1, 
+    low_latency ? nes::AudioLatency::low() : nes::AudioLatency()
+  );
+  sound.init(nes);
 
-    while(!nes.clock()){
+  sound.play([&](nes::Nes& nes, float* output, nes::u32 frame_count){
+    nes.render_audio(output, frame_count, sound.channels, [&]{
       debugger.loop(window, nes);
-
-      if (nes.paused) return 0.f;
-      time += 1.0 / nes::Nes::CyclesPerSec;
-    }
-    debugger.loop(window, nes);
-
-    auto& apu = nes.apu;
-    const auto pulse_out = 0.00752f * (apu.pulse1.output(time) + apu.pulse2.output(time));
-    const auto noise_out = 0.00494f * apu.noise.output();
-    const auto final_sample = pulse_out + noise_out;
-
-    return std::clamp(final_sample, -1.f, 1.f);
+    });
   });
 
   while(!window.should_close()){
@@ -86,15 +85,21 @@ auto main(int argc, char** argv) -> int{
 
     if (glfwGetKey(window.window, GLFW_KEY_TAB) == GLFW_PRESS){
       std::cerr << "FPS: " << 1.0 / delta_time << '\n';
+      std::cerr << "Audio latency: " << sound.telemetry.latency_ms << " ms";
+      std::cerr << " (" << sound.telemetry.buffer_frames << " frames buffered)";
+      std::cerr << ", underruns: " << sound.telemetry.underruns << '\n';
     }
 
+    sound.adapt();
+
     window.clear_buffer();
 
     debugger.render(nes);
     renderer.render_texture(debugger.texture, nes::vec2(nes::Ppu::ScreenSize.x * 2.f, 0.f));
     nes.render_request.wait([&]{ return nes.ppu.frame_complete; });
 
-    renderer.render_texture(*nes.ppu.finished_texture, nes::vec2(0.f));
+    screen.copy(nes.finished_framebuffer);
+    renderer.render_texture(screen, nes::vec2(0.f));
 
     window.swap_interval(0);
     window.update_buffer();
@@ -104,6 +109,11 @@ auto main(int argc, char** argv) -> int{
     delta_time = glfwGetTime() - start_frame_time;
   }
 
-  nes.apu.stop();
+  sound.stop();
+
+  if constexpr (nes::BankTracePolicy::Enabled){
+    auto summary = std::ofstream(nes::RomImage::remove_extension(rom_path) + ".banks.json");
+    nes.cardridge.banks->trace.write_json(summary, nes.cardridge.rom->game_name, nes.cardridge.mapper_id());
+  }
 
 }
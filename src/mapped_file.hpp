@@ -0,0 +1,110 @@
+#pragma once
+
+#include "aliases.hpp"
+#include "util.hpp"
+#include <string>
+#include <vector>
+#include <stdexcept>
+
+#ifdef _WIN32
+#include <iterator>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace nes{
+
+//Read-only view of a whole file. On POSIX systems the file is memory-mapped, so every process
+//and instance opening the same file shares its physical pages through the page cache
+struct MappedFile{
+  const u8* data = nullptr;
+  u32 size = 0;
+
+#ifdef _WIN32
+  std::vector<u8> buffer;
+#endif
+
+  MappedFile() {}
+
+  MappedFile(const std::string& filepath){
+#ifdef _WIN32
+    auto file = file_open_for_reading(filepath, std::ios::binary);
+    buffer.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+
+    data = buffer.data();
+    size = buffer.size();
+#else
+    const auto fd = ::open(filepath.c_str(), O_RDONLY);
+    if (fd < 0){
+      throw std::runtime_error("Unable to open file: " + filepath);
+    }
+
+    struct stat info;
+    if (::fstat(fd, &info) != 0){
+      ::close(fd);
+      throw std::runtime_error("Unable to read file size: " + filepath);
+    }
+
+    size = info.st_size;
+
+    if (size > 0){
+      const auto mapping = ::mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+      if (mapping == MAP_FAILED){
+        ::close(fd);
+        throw std::runtime_error("Unable to map file: " + filepath);
+      }
+
+      data = static_cast<const u8*>(mapping);
+    }
+
+    //The mapping stays valid after the descriptor is closed
+    ::close(fd);
+#endif
+  }
+
+  MappedFile(const MappedFile&) = delete;
+  auto operator=(const MappedFile&) -> MappedFile& = delete;
+
+  MappedFile(MappedFile&& other){
+    *this = std::move(other);
+  }
+
+  auto operator=(MappedFile&& other) -> MappedFile&{
+    if (this == &other) return *this;
+
+    unmap();
+#ifdef _WIN32
+    buffer = std::move(other.buffer);
+#endif
+    data = other.data;
+    size = other.size;
+
+    other.data = nullptr;
+    other.size = 0;
+
+    return *this;
+  }
+
+  auto bytes() const{
+    return Span<const u8>(data, size);
+  }
+
+  auto unmap() -> void{
+#ifndef _WIN32
+    if (data != nullptr){
+      ::munmap(const_cast<u8*>(data), size);
+    }
+#endif
+    data = nullptr;
+    size = 0;
+  }
+
+  ~MappedFile(){
+    unmap();
+  }
+};
+
+} //namespace nes
@@ -2,110 +2,177 @@
 
 #include "aliases.hpp"
 #include "util.hpp"
-#include <fstream>
+#include "bank_trace.hpp"
+#include <variant>
+#include <array>
+#include <vector>
+#include <string>
 
 namespace nes{
 
-struct MapperResult{
-  enum class Status{
-    Mapped,
-    NotMapped,
-    UsedCartridgeRam
+template<typename Trace>
+struct BasicMapper{
+  enum class Mirroring{
+    OneScreenLow,
+    OneScreenHigh,
+    Horizontal,
+    Vertical,
+    Hardware
   };
 
-  u32 address;
-  u32 data;
-  Status status;
+  static constexpr auto ProgramPageShift = 13;
+  static constexpr auto ProgramPageSize = 1 << ProgramPageShift;
+  static constexpr auto CharPageShift = 10;
+  static constexpr auto CharPageSize = 1 << CharPageShift;
+
+  //Base pointers of the 8Kb windows at $8000-$FFFF and the 1Kb windows at PPU $0000-$1FFF.
+  //Updated only when bank registers change, so reads never compute offsets:
+  std::array<const u8*, 4> program_pages{};
+  std::array<const u8*, 8> char_pages{};
+
+  Span<const u8> program_memory;
+  Span<const u8> char_memory;
+
+  //Cartridge RAM at $6000-$7FFF, owned by the cartridge:
+  Span<u8> static_ram;
+
+  //What an access to a page reaches. Only Ram pages are ever written and Register pages forward
+  //writes to the mapper, so ROM can stay in read-only shared memory
+  enum class PageKind : u8{
+    OpenBus,
+    Rom,
+    Ram,
+    Register
+  };
 
-  MapperResult() {}
-  MapperResult(u32 address) : address(address), status(Status::Mapped) {}
+  struct PageAccess{
+    PageKind read = PageKind::OpenBus;
+    PageKind write = PageKind::OpenBus;
+  };
 
-  auto has_address() const{
-    return status == Status::Mapped;
-  }
+  //CPU space in 8Kb pages, only $6000-$FFFF ever belongs to the cartridge:
+  std::array<PageAccess, 8> cpu_pages{};
+  std::array<PageKind, 8> char_page_kinds{};
 
-  auto used_cartridge_ram() const{
-    return status == Status::UsedCartridgeRam;
+  auto attach(Span<const u8> program_memory, Span<const u8> char_memory, Span<u8> static_ram, bool char_writable){
+    this->program_memory = program_memory;
+    this->char_memory = char_memory;
+    this->static_ram = static_ram;
+
+    char_page_kinds.fill(char_writable ? PageKind::Ram : PageKind::Rom);
   }
 
-  static auto not_mapped(){
-    auto r = MapperResult();
-    r.status = Status::NotMapped;
+  //Points a copied mapper at its new cartridge's CHR and PRG-RAM, keeping the selected banks.
+  //PRG banks stay in the shared ROM image and need no change
+  auto rebind(Span<const u8> char_memory, Span<u8> static_ram){
+    for (auto& page : char_pages){
+      if (page != nullptr){
+        page = char_memory.data() + (page - this->char_memory.data());
+      }
+    }
 
-    return r;
+    this->char_memory = char_memory;
+    this->static_ram = static_ram;
   }
 
-  static auto used_cartridge_ram(u32 data){
-    auto r = MapperResult();
-    r.status = Status::UsedCartridgeRam;
-    r.data = data;
+  auto classify_cpu(u16 address, u32 size, PageKind read, PageKind write){
+    for (auto i : range(size >> ProgramPageShift)){
+      cpu_pages[(address >> ProgramPageShift) + i] = PageAccess{ read, write };
+    }
+  }
 
-    return r;
+  auto cpu_page(u16 address) const -> const PageAccess&{
+    return cpu_pages[address >> ProgramPageShift];
   }
-};
 
-struct Mapper{
-  enum class Mirroring{
-    OneScreenLow,
-    OneScreenHigh,
-    Horizontal,
-    Vertical,
-    Hardware
-  };
+  auto char_page(u16 address) const{
+    return char_page_kinds[(address >> CharPageShift) & 0x07];
+  }
 
-  virtual auto cpu_write(u16 address, u8 data) -> MapperResult = 0;
-  virtual auto cpu_read(u16 address) -> MapperResult = 0;
-  virtual auto ppu_write(u16 address, u8 data) -> MapperResult = 0;
-  virtual auto ppu_read(u16 address) -> MapperResult = 0;
-  virtual auto mirroring() -> Mirroring{
-    return Mirroring::Hardware;
+  //Offsets wrap around the memory size, the same way unconnected bank bits mirror on hardware:
+  auto map_program(u8 page, u32 offset){
+    program_pages[page] = program_memory.data() + offset % program_memory.size();
   }
 
-  virtual auto irq_state() -> bool{
-    return false;
+  auto map_char(u8 page, u32 offset){
+    char_pages[page] = char_memory.data() + offset % char_memory.size();
   }
 
-  virtual auto irq_clear() -> void{}
+  //Maps 'size' bytes starting at 'address' to consecutive memory starting at 'offset':
+  auto map_program(u16 address, u32 size, u32 offset){
+    const auto first_page = (address - 0x8000) >> ProgramPageShift;
 
-  virtual auto update_irq_counter(u16 address) -> void{}
+    for (auto i : range(size >> ProgramPageShift)){
+      map_program(first_page + i, offset + i * ProgramPageSize);
+    }
+  }
 
-  virtual auto current_program_bank() -> u16 = 0;
-  virtual ~Mapper() {}
-};
+  auto map_char(u16 address, u32 size, u32 offset){
+    const auto first_page = address >> CharPageShift;
 
-struct Mapper000 : Mapper{
-  u8 program_banks;
+    for (auto i : range(size >> CharPageShift)){
+      map_char(first_page + i, offset + i * CharPageSize);
+    }
+  }
+
+  auto read_program(u16 address) const{
+    return program_pages[(address >> ProgramPageShift) & 0x03][address & (ProgramPageSize - 1)];
+  }
 
-  Mapper000(u8 program_banks) : program_banks(program_banks) {}
+  auto read_char(u16 address) const{
+    return char_pages[(address >> CharPageShift) & 0x07][address & (CharPageSize - 1)];
+  }
 
-  auto cpu_read(u16 address) -> MapperResult override{
-    if (in_range(address, { 0x8000, 0xFFFF })){
-      return address & (program_banks > 1 ? 0x7FFF : 0x3FFF);
-    }
+  //Position of a PPU address inside 'char_memory':
+  auto char_offset(u16 address) const -> u32{
+    return char_pages[(address >> CharPageShift) & 0x07] - char_memory.data() + (address & (CharPageSize - 1));
+  }
+
+  //Defaults, hidden by mappers that implement them:
+
+  //Only called for Register pages:
+  auto cpu_write(u16, u8) -> void{}
 
-    return MapperResult::not_mapped();
+  auto mirroring() const -> Mirroring{
+    return Mirroring::Hardware;
   }
 
-  auto cpu_write(u16 address, u8 data) -> MapperResult override{
-    //The same as read
-    return cpu_read(address);
+  auto irq_state() const -> bool{
+    return false;
   }
 
-  auto ppu_read(u16 address) -> MapperResult override{
-    if (in_range(address, { 0x0000, 0x1FFF })){
-      return address;
+  //Bank-switch instrumentation, compiled away unless built with NES_BANK_TRACE:
+  Trace trace;
+
+  auto trace_bank_write(u8 bank_register, u16 address, u8 data){
+    if constexpr (Trace::Enabled){
+      trace.bank_write(bank_register, address, data);
     }
+  }
+
+  //Called for every rising edge of PPU A12 that survives the M2 filter:
+  auto clock_irq_counter() -> void{}
 
-    return MapperResult::not_mapped();
+  //Counted A12 edges until the IRQ line goes up, 0 when no IRQ is coming:
+  auto irq_edges_remaining() const -> u32{
+    return 0;
   }
+};
+
+using Mapper = BasicMapper<BankTracePolicy>;
+
+struct Mapper000 : Mapper{
+  u8 program_banks;
 
-  auto ppu_write(u16 address, u8 data) -> MapperResult override{
-    //The same as read
-    return ppu_read(address);
+  Mapper000(u8 program_banks = 1) : program_banks(program_banks){
+    //No registers, writes to PRG-ROM are dropped
+    classify_cpu(0x8000, 32_kb, PageKind::Rom, PageKind::Rom);
   }
 
-  auto current_program_bank() -> u16 override{
-    return 0;
+  auto update_banks(){
+    //16Kb carts are mirrored into $C000-$FFFF by the modulo
+    map_program(0x8000, 32_kb, 0);
+    map_char(0x0000, 8_kb, 0);
   }
 };
 
@@ -127,75 +194,38 @@ struct Mapper001 : Mapper{
 
   Mirroring mirroring_buffer = Mirroring::OneScreenHigh;
 
-  std::vector<u8> static_ram;
-  std::string game_name;
-
-  Mapper001(const std::string& game_name, u8 program_banks, u8 char_banks) 
-  : program_banks(program_banks), char_banks(char_banks), game_name(game_name) {
-    static_ram.resize(32_kb, 0);
-
-    auto file = std::ifstream(game_name + ".sav", std::ios::binary);
-    if (!file) return;
-
-    file.read(reinterpret_cast<char*>(static_ram.data()), static_ram.size());
-  }
-
-  auto current_program_bank() -> u16 override{
-    const auto program_mode = (control >> 2) & 0x03;
-    if (program_mode < 2){
-      return selected_program_bank32;
-    }
-    else if (program_mode == 2){
-      return selected_program_bank16_low;
-    }
-    else if (program_mode == 3){
-      return selected_program_bank16_high;
-    }
-    return 0;
+  Mapper001(u8 program_banks, u8 char_banks) 
+  : program_banks(program_banks), char_banks(char_banks){
+    classify_cpu(0x6000, 8_kb, PageKind::Ram, PageKind::Ram);
+    classify_cpu(0x8000, 32_kb, PageKind::Rom, PageKind::Register);
   }
 
-  auto in_static_ram_range(u16 address){
-    return in_range(address, { 0x6000, 0x7FFF });
-  }
-
-  auto cpu_read(u16 address) -> MapperResult override{
-    if (address < 0x6000){
-      return MapperResult::not_mapped();
-    }
-
-    if (in_static_ram_range(address)){
-      return MapperResult::used_cartridge_ram(static_ram[address & 0x1FFF]);
-    }
-
+  auto update_banks(){
     if (control & 0b01000){
       //16Kb mode:
-      if (in_range(address, { 0x8000, 0xBFFF })){
-        return selected_program_bank16_low * 16_kb + (address & 0x3FFF);
-      }
-
-      if (in_range(address, { 0xC000, 0xFFFF })){
-        return selected_program_bank16_high * 16_kb + (address & 0x3FFF);
-      }
-
+      map_program(0x8000, 16_kb, selected_program_bank16_low * 16_kb);
+      map_program(0xC000, 16_kb, selected_program_bank16_high * 16_kb);
     }
     else{
       //32Kb mode:
-      return selected_program_bank32 * 32_kb + (address & 0x7FFF);
+      map_program(0x8000, 32_kb, selected_program_bank32 * 32_kb);
     }
 
-    return MapperResult::not_mapped();
-  }
-
-  auto cpu_write(u16 address, u8 data) -> MapperResult override{
-    if (address < 0x6000){ 
-      return MapperResult::not_mapped();
+    if (char_banks == 0){
+      map_char(0x0000, 8_kb, 0);
     }
-
-    if (in_static_ram_range(address)){
-      static_ram[address & 0x1FFF] = data;
-      return MapperResult::used_cartridge_ram(0);
+    else if (control & 0b10000){
+      //4Kb mode:
+      map_char(0x0000, 4_kb, selected_char_bank4_low * 4_kb);
+      map_char(0x1000, 4_kb, selected_char_bank4_high * 4_kb);
     }
+    else{
+      //8Kb mode, the bank number is in 4Kb units with the lowest bit ignored:
+      map_char(0x0000, 8_kb, selected_char_bank8 * 4_kb);
+    }
+  }
 
+  auto cpu_write(u16 address, u8 data) -> void{
     if (data & 0x80){
       shift_buffer = 0;
       shift_buffer_size = 0;
@@ -206,9 +236,10 @@ struct Mapper001 : Mapper{
       shift_buffer |= (data & 0x01) << 4;
       shift_buffer_size++;
 
-      if (shift_buffer_size < 5) return MapperResult::not_mapped();
+      if (shift_buffer_size < 5) return;
 
       const auto target_register = (address >> 13) & 0x03;
+      trace_bank_write(target_register, address, shift_buffer);
 
       if (target_register == 0){
         control = shift_buffer & 0x1F;
@@ -256,43 +287,12 @@ struct Mapper001 : Mapper{
       shift_buffer_size = 0;
     }
 
-    return MapperResult::not_mapped();
-  }
-
-  auto ppu_read(u16 address) -> MapperResult override{
-    if (address >= 0x2000) return MapperResult::not_mapped();
-
-    if (char_banks == 0){
-      return address;
-    }
-
-    if (control & 0b10000){
-      if (in_range(address, { 0x0000, 0x0FFF })){
-        return selected_char_bank4_low * 4_kb + (address & 0x0FFF);
-      }
-      if (in_range(address, { 0x1000, 0x1FFF })){
-        return selected_char_bank4_high * 4_kb + (address & 0x0FFF);
-      }
-    }
-    else{
-      return selected_char_bank8 * 8_kb + (address & 0x1FFF);
-    }
-
-    return MapperResult::not_mapped();
-  }
-
-  auto ppu_write(u16 address, u8 data) -> MapperResult override{
-    return ppu_read(address);
+    update_banks();
   }
 
-  auto mirroring() -> Mirroring override{
+  auto mirroring() const -> Mirroring{
     return mirroring_buffer;
   }
-
-  ~Mapper001() override{
-    auto file = std::ofstream(game_name + ".sav", std::ios::binary);
-    file.write(reinterpret_cast<char*>(static_ram.data()), static_ram.size()); 
-  }
 };
 
 struct Mapper002 : Mapper{
@@ -301,46 +301,20 @@ struct Mapper002 : Mapper{
   u8 char_banks;
 
   Mapper002(u8 program_banks, u8 char_banks) 
-  : program_banks(program_banks), char_banks(char_banks) {}
-
-  auto cpu_read(u16 address) -> MapperResult override{
-    if (in_range(address, { 0x8000, 0xBFFF })){
-      return selected_program_bank * 16_kb + (address - 0x8000);
-    }
-    if (in_range(address, { 0xC000, 0xFFFF })){
-      return (program_banks - 1) * 16_kb + (address - 0xC000);
-    }
-
-    return MapperResult::not_mapped();
-  }
-
-  auto cpu_write(u16 address, u8 data) -> MapperResult override{
-    if (in_range(address, { 0x8000, 0xFFFF })){
-      selected_program_bank = data & 0x0F;
-    }
-    return MapperResult::not_mapped();
+  : program_banks(program_banks), char_banks(char_banks){
+    classify_cpu(0x8000, 32_kb, PageKind::Rom, PageKind::Register);
   }
 
-  auto ppu_read(u16 address) -> MapperResult override{
-    if (in_range(address, { 0x0000, 0x1fff })){
-      return (address);
-    }
-
-    return MapperResult::not_mapped();
+  auto update_banks(){
+    map_program(0x8000, 16_kb, selected_program_bank * 16_kb);
+    map_program(0xC000, 16_kb, (program_banks - 1) * 16_kb);
+    map_char(0x0000, 8_kb, 0);
   }
 
-  auto ppu_write(u16 address, u8 data) -> MapperResult override{
-    if (in_range(address, { 0x0000, 0x1fff })){
-      if (char_banks == 0){
-        return (address);
-      }
-    }
-
-    return MapperResult::not_mapped();
-  }
-
-  auto current_program_bank() -> u16 override{
-    return selected_program_bank;
+  auto cpu_write(u16 address, u8 data) -> void{
+    selected_program_bank = data & 0x0F;
+    trace_bank_write(0, address, data);
+    update_banks();
   }
 };
 
@@ -350,59 +324,33 @@ struct Mapper003 : Mapper{
   u8 char_banks;
 
   Mapper003(u8 program_banks, u8 char_banks) 
-  : program_banks(program_banks), char_banks(char_banks) {
-  }
-
-  auto cpu_read(u16 address) -> MapperResult override{
-    if (in_range(address, { 0x8000, 0xFFFF })){
-      return address & (program_banks > 1 ? 0x7FFF : 0x3FFF);
-    }
-
-    return MapperResult::not_mapped();
+  : program_banks(program_banks), char_banks(char_banks){
+    classify_cpu(0x8000, 32_kb, PageKind::Rom, PageKind::Register);
   }
 
-  auto cpu_write(u16 address, u8 data) -> MapperResult override{
-    if (in_range(address, { 0x8000, 0xFFFF })){
-      selected_char_bank = data & 0x03;
-      return address;
-    }
-
-    return MapperResult::not_mapped();
+  auto update_banks(){
+    map_program(0x8000, 32_kb, 0);
+    map_char(0x0000, 8_kb, selected_char_bank * 8_kb);
   }
 
-  auto ppu_read(u16 address) -> MapperResult override{
-    if (in_range(address, { 0x0000, 0x1fff })){
-      return selected_char_bank * 8_kb + address;
-    }
-
-    return MapperResult::not_mapped();
-  }
-
-  auto ppu_write(u16 address, u8 data) -> MapperResult override{
-    return MapperResult::not_mapped();
-  }
-
-  auto current_program_bank() -> u16 override{
-    return 0;
+  auto cpu_write(u16 address, u8 data) -> void{
+    selected_char_bank = data & 0x03;
+    trace_bank_write(0, address, data);
+    update_banks();
   }
 };
 
 struct Mapper004 : Mapper{
-  std::vector<u8> static_ram;
-  std::string game_name;
   u32 registers[8]{};
-  u32 char_banks[8]{};
-  u32 program_banks[4]{};
 
   Mirroring mirroring_buffer = Mirroring::Horizontal;
 
-  u16 irq_counter = 0;
-  u16 irq_reload = 0;
+  u8 irq_counter = 0;
+  u8 irq_latch = 0;
+  bool irq_reload_pending = false;
 
   u8 program_banks_count = 0;
 
-  u8 current_program_bank_buffer = 0;
-
   u8 target_register = 0;
   bool program_bank_mode = 0;
   bool char_bank_mode = 0;
@@ -411,111 +359,54 @@ struct Mapper004 : Mapper{
   bool irq_active = false;
 
 
-  Mapper004(const std::string& game_name, u8 program_banks) : game_name(game_name), program_banks_count(program_banks){
-    static_ram.resize(32_kb);
+  Mapper004(u8 program_banks) : program_banks_count(program_banks){
+    //Power-on layout: first two 8Kb banks at $8000, last two at $C000
+    registers[7] = 1;
 
-    this->program_banks[0] = 0 * 0x2000;
-    this->program_banks[1] = 1 * 0x2000;
-    this->program_banks[2] = (program_banks_count * 2 - 2) * 0x2000;
-    this->program_banks[3] = (program_banks_count * 2 - 1) * 0x2000;
-
-    auto file = std::ifstream(game_name + ".sav", std::ios::binary);
-    if (!file) return;
-
-    file.read(reinterpret_cast<char*>(static_ram.data()), static_ram.size());
+    classify_cpu(0x6000, 8_kb, PageKind::Ram, PageKind::Ram);
+    classify_cpu(0x8000, 32_kb, PageKind::Rom, PageKind::Register);
   }
 
-  auto in_static_ram_range(u16 address){
-    return in_range(address, { 0x6000, 0x7FFF });
-  }
+  auto update_banks(){
+    //R0 and R1 select 2Kb banks, R2-R5 select 1Kb banks; 'char_bank_mode' swaps the halves
+    const auto two_kb_half = char_bank_mode ? 0x1000 : 0x0000;
+    const auto one_kb_half = char_bank_mode ? 0x0000 : 0x1000;
 
-  auto cpu_read(u16 address) -> MapperResult override{
-    if (address < 0x6000){
-      return MapperResult::not_mapped();
-    }
+    map_char(two_kb_half + 0x0000, 2_kb, (registers[0] & 0xFE) * 1_kb);
+    map_char(two_kb_half + 0x0800, 2_kb, (registers[1] & 0xFE) * 1_kb);
 
-    if (in_static_ram_range(address)){
-      return MapperResult::used_cartridge_ram(static_ram[address & 0x1FFF]);
+    for (auto i : range(4)){
+      map_char(one_kb_half + i * 1_kb, 1_kb, registers[2 + i] * 1_kb);
     }
 
-    if (address >= 0xE000) current_program_bank_buffer = program_banks_count - 1;
-
-    else if (address >= 0xC000) {
-        if (program_bank_mode == 0) current_program_bank_buffer = program_banks_count - 2;
-        else current_program_bank_buffer = registers[6];
-    }
+    const auto second_last_bank = (program_banks_count * 2 - 2) * 8_kb;
+    const auto swappable_bank = (registers[6] & 0x3F) * 8_kb;
 
-    else if (address >= 0xA000) current_program_bank_buffer = registers[7];
-
-    else if (address >= 0x8000) {
-        if (program_bank_mode == 0) current_program_bank_buffer = registers[6];
-        else current_program_bank_buffer = program_banks_count - 2;
-    }
-
-    const auto bank_index = (address - 0x8000) / 0x2000;
-    return program_banks[bank_index] + (address & 0x1FFF);
+    map_program(0x8000, 8_kb, program_bank_mode ? second_last_bank : swappable_bank);
+    map_program(0xA000, 8_kb, (registers[7] & 0x3F) * 8_kb);
+    map_program(0xC000, 8_kb, program_bank_mode ? swappable_bank : second_last_bank);
+    map_program(0xE000, 8_kb, (program_banks_count * 2 - 1) * 8_kb);
   }
 
-  auto cpu_write(u16 address, u8 data) -> MapperResult override{
-    if (in_static_ram_range(address)){
-      static_ram[address & 0x1FFF] = data;
-      return MapperResult::used_cartridge_ram(0);
-    }
-
+  auto cpu_write(u16 address, u8 data) -> void{
     if (in_range(address, { 0x8000, 0x9FFF })){
       if (is_even(address)){
         target_register = data & 0x07;
         program_bank_mode = data & 0x40;
         char_bank_mode = data & 0x80;
 
-        return MapperResult::not_mapped();
+        return;
       }
 
       registers[target_register] = data;
+      trace_bank_write(target_register, address, data);
+      update_banks();
 
-      if (char_bank_mode){
-        char_banks[0] = registers[2];
-        char_banks[1] = registers[3];
-        char_banks[2] = registers[4];
-        char_banks[3] = registers[5];
-        char_banks[4] = registers[0] & 0xFE;
-        char_banks[5] = registers[0] + 1;
-        char_banks[6] = registers[1] & 0xFE;
-        char_banks[7] = registers[1] + 1;
-      }
-      else{
-        char_banks[4] = registers[2];
-        char_banks[5] = registers[3];
-        char_banks[6] = registers[4];
-        char_banks[7] = registers[5];
-        char_banks[0] = registers[0] & 0xFE;
-        char_banks[1] = registers[0] + 1;
-        char_banks[2] = registers[1] & 0xFE;
-        char_banks[3] = registers[1] + 1;
-      }
-
-      for (auto& bank : char_banks){
-        bank *= 0x0400;
-      }
-
-      auto bank_index1 = 0;
-      auto bank_index2 = 2;
-
-      if (program_bank_mode){
-        std::swap(bank_index1, bank_index2);
-      }
-
-      program_banks[bank_index1] = (registers[6] & 0x3F) * 0x2000;
-      program_banks[bank_index2] = (program_banks_count * 2 - 2) * 0x2000;
-
-      program_banks[1] = (registers[7] & 0x3F) * 0x2000;
-			program_banks[3] = (program_banks_count * 2 - 1) * 0x2000;
-
-      return MapperResult::not_mapped();
+      return;
     }
 
     if (in_range(address, { 0xA000, 0xBFFF })){
-      if (!is_even(address)) return MapperResult::not_mapped();
+      if (!is_even(address)) return;
 
       if (is_even(data)){
         mirroring_buffer = Mirroring::Vertical;
@@ -524,18 +415,19 @@ struct Mapper004 : Mapper{
         mirroring_buffer = Mirroring::Horizontal;
       }
 
-      return MapperResult::not_mapped();
+      return;
     }
 
     if (in_range(address, { 0xC000, 0xDFFF })){
       if (is_even(address)){
-        irq_counter = 0;
+        irq_latch = data;
       }
       else{
-        irq_reload = data;
+        irq_counter = 0;
+        irq_reload_pending = true;
       }
 
-      return MapperResult::not_mapped();
+      return;
     }
 
     if (in_range(address, { 0xE000, 0xFFFF })){
@@ -546,56 +438,42 @@ struct Mapper004 : Mapper{
       else{
         irq_enabled = true;
       }
-
-      return MapperResult::not_mapped();
     }
-
-    return MapperResult::not_mapped();
   }
 
-  auto ppu_read(u16 address) -> MapperResult override{
-    if (address > 0x1FFF) return MapperResult::not_mapped();
-
-    const auto bank_index = address / 0x400;
-
-    return char_banks[bank_index] + (address & 0x03FF);
-  }
-
-  auto ppu_write(u16 address, u8 data) -> MapperResult override{
-    return MapperResult::not_mapped();
-  }
-
-  auto mirroring() -> Mirroring override{
+  auto mirroring() const -> Mirroring{
     return mirroring_buffer;
   }
 
-  auto irq_state() -> bool override{
+  auto irq_state() const -> bool{
     return irq_active;
   }
 
-  auto irq_clear() -> void override{
-    irq_active = false;
-  }
-
-  auto update_irq_counter(u16 address) -> void override{
-    if (irq_counter == 0) {
-      irq_counter = irq_reload;
-    } else {
+  //The line stays up until the game acknowledges it with a write to $E000
+  auto clock_irq_counter() -> void{
+    if (irq_counter == 0 || irq_reload_pending){
+      irq_counter = irq_latch;
+      irq_reload_pending = false;
+    }
+    else{
       irq_counter--;
-      if (irq_counter == 0 && irq_enabled) {
-        irq_active = true;
-      }
     }
-  }
 
-  auto current_program_bank() -> u16 override{
-    return current_program_bank_buffer;
+    if (irq_counter == 0 && irq_enabled){
+      irq_active = true;
+    }
   }
 
-  ~Mapper004(){
-    auto file = std::ofstream(game_name + ".sav", std::ios::binary);
-    file.write(reinterpret_cast<char*>(static_ram.data()), static_ram.size()); 
+  auto irq_edges_remaining() const -> u32{
+    if (!irq_enabled) return 0;
+
+    if (irq_counter == 0 || irq_reload_pending){
+      return irq_latch + 1;
+    }
+
+    return irq_counter;
   }
+
 };
 
 struct Mapper066 : Mapper{
@@ -605,40 +483,31 @@ struct Mapper066 : Mapper{
   u8 char_banks;
 
   Mapper066(u8 program_banks, u8 char_banks) 
-  : program_banks(program_banks), char_banks(char_banks) {
-  }
-
-  auto cpu_read(u16 address) -> MapperResult override{
-    if (in_range(address, { 0x8000, 0xFFFF })){
-      return selected_program_bank * 32_kb + (address & 0x7FFF);
-    }
-
-    return MapperResult::not_mapped();
+  : program_banks(program_banks), char_banks(char_banks){
+    classify_cpu(0x8000, 32_kb, PageKind::Rom, PageKind::Register);
   }
 
-  auto cpu_write(u16 address, u8 data) -> MapperResult override{
-    if (in_range(address, { 0x8000, 0xFFFF })){
-      selected_char_bank = data & 0x03;
-      selected_program_bank = (data & 0x30) >> 4;
-    }
-    return MapperResult::not_mapped();
+  auto update_banks(){
+    map_program(0x8000, 32_kb, selected_program_bank * 32_kb);
+    map_char(0x0000, 8_kb, selected_char_bank * 8_kb);
   }
 
-  auto ppu_read(u16 address) -> MapperResult override{
-    if (in_range(address, { 0x0000, 0x1fff })){
-      return selected_char_bank * 8_kb + address;
-    }
-
-    return MapperResult::not_mapped();
-  }
-
-  auto ppu_write(u16 address, u8 data) -> MapperResult override{
-    return MapperResult::not_mapped();
-  }
-
-  auto current_program_bank() -> u16 override{
-    return selected_program_bank;
+  auto cpu_write(u16 address, u8 data) -> void{
+    selected_char_bank = data & 0x03;
+    selected_program_bank = (data & 0x30) >> 4;
+    trace_bank_write(0, address, data);
+    update_banks();
   }
 };
 
+//Every supported mapper, dispatched statically so the access paths can inline into the CPU and PPU:
+using MapperVariant = std::variant<
+  Mapper000, 
+  Mapper001, 
+  Mapper002, 
+  Mapper003, 
+  Mapper004, 
+  Mapper066
+>;
+
 } //namespace nes
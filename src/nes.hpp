@@ -1,38 +1,30 @@
 #pragma once
 
 #include <array>
+#include <memory>
+#include <type_traits>
 #include "util.hpp"
 #include "aliases.hpp"
 #include "cardridge.hpp"
 #include "ppu.hpp"
 #include "cpu.hpp"
 #include "apu.hpp"
+#include "audio_sink.hpp"
+#include "hash.hpp"
 
 namespace nes{
 
-struct Nes{
-  static constexpr auto DisableVisualMode = false;
-
-  static constexpr auto AudioSampleRate = 44100.0;
-  static constexpr auto CyclesPerSec = 5369318.0;
+//Everything the emulation loop changes, except the mapper which lives with its cartridge.
+//Trivially copyable and cache-line aligned: copying a state is one memcpy and the CPU registers
+//and bus bookkeeping at the front share the first line
+struct alignas(64) NesState{
+  static constexpr auto AudioSampleRate = u32(44100);
+  static constexpr auto CyclesPerSec = u32(5369318);
 
-  static constexpr auto CpuMemAddressRange = std::make_pair(0x0000, 0x1FFF);
   static constexpr auto CpuMemSize = 0x0800;
 
-  static constexpr auto PpuMemAddressRange = std::make_pair(0x2000, 0x3FFF);
-
-  static constexpr auto Controller1Address = 0x4016;
-  static constexpr auto DMAAddress = 0x4014;
-
   Cpu cpu;
-  Ppu ppu;
-  Apu apu = Apu(*this);
-  Cardridge cardridge;
-  std::array<u8, 1024 * 8> ram;
-  Request render_request;
 
-  bool paused = false;
-  
   u32 cycles = 0;
 
   u8 controllers[2]{};
@@ -45,22 +37,74 @@ struct Nes{
   bool dma_transfer_started = false;
   bool dma_dummy_cycle = true;
 
-  double audio_time = 0.0;
-  double audio_sample = 0.0;
-
   u16 nmi_pc = 0x0;
 
-  Nes(bool visual_mode = true) : ppu(visual_mode) {
+  //PPU dot at which the cartridge IRQ line is looked at next. Between A12 edges the MMC3 counter
+  //can't change, so the line only needs checking at the predicted dot and after writes that
+  //change the prediction (mapper registers, PPU registers)
+  u64 irq_dot = 0;
+
+  //Only 2Kb is wired up, $0800-$1FFF mirror it:
+  std::array<u8, CpuMemSize> ram{};
+
+  Ppu ppu;
+  Apu apu;
+
+  SampleClock sample_clock = SampleClock(CyclesPerSec, AudioSampleRate);
+  float audio_sample = 0.f;
+};
+
+static_assert(std::is_trivially_copyable_v<NesState>);
+
+struct Nes : NesState{
+  static constexpr auto DisableVisualMode = false;
+  static constexpr auto PersistSave = true;
+
+  static constexpr auto CpuMemAddressRange = std::make_pair(0x0000, 0x1FFF);
+  static constexpr auto PpuMemAddressRange = std::make_pair(0x2000, 0x3FFF);
+
+  static constexpr auto Controller1Address = 0x4016;
+  static constexpr auto Controller2Address = 0x4017;
+  static constexpr auto DMAAddress = 0x4014;
+
+  //Cold members, touched once per frame or on configuration:
+  Cardridge cardridge;
+
+  Framebuffer finished_framebuffer;
+  Framebuffer draw_framebuffer;
+
+  Request render_request;
+  bool paused = false;
+
+  //Optional, receives every mixed sample as it is produced:
+  AudioSink* audio_sink = nullptr;
+
+  Nes(bool visual_mode = true)
+  : finished_framebuffer(Ppu::ScreenSize, visual_mode), draw_framebuffer(Ppu::ScreenSize, visual_mode){
     cpu.status.set(Cpu::Status::InterruptDisable);
     cpu.status.set(Cpu::Status::Unused);
   }
 
+  //Any output rate up to the CPU clock works (32000, 44100, 48000, 96000...), the schedule restarts
+  //from the current cycle. Other rates throw and leave the current clock in place
+  auto set_audio_sample_rate(u32 sample_rate){
+    const auto ticks = sample_clock.ticks;
+
+    sample_clock = SampleClock(CyclesPerSec, sample_rate);
+    sample_clock.ticks = ticks;
+  }
+
   auto in_apu_range(u16 address) const{
     return in_range(address, std::make_pair(0x4000, 0x4013)) || address == 0x4015 || address == 0x4017;
   }
 
-  auto load_cardridge(const std::string& filepath){
-    cardridge.from_file(filepath);
+  //With 'persist_save' a battery cart's PRG-RAM is the .sav file next to the ROM
+  auto load_cardridge(const std::string& filepath, bool persist_save = false){
+    load_cardridge(RomImage::load(filepath), persist_save);
+  }
+
+  auto load_cardridge(std::shared_ptr<const RomImage> rom, bool persist_save = false) -> void{
+    cardridge.attach(std::move(rom), persist_save);
     cpu.absolute_address = 0xFFFC;
 
     u16 lo = mem_read(cpu.absolute_address);
@@ -78,12 +122,18 @@ struct Nes{
       return ram[address & (Nes::CpuMemSize - 1)];
     }
     else if (in_range(address, PpuMemAddressRange)){
+      //$2007 reads put the VRAM address on the bus, which can clock the MMC3 counter:
+      if ((address & 0x0007) == Ppu::CpuDataPort){
+        irq_dot = 0;
+      }
+
       //Can mutate PPU!!!
       return ppu.cpu_read(*this, address);
     }
-    else if (address == Controller1Address){
-      const auto data = (controller_buffers[0] & 0x80) > 0;
-      controller_buffers[0] <<= 1;
+    else if (address == Controller1Address || address == Controller2Address){
+      auto& buffer = controller_buffers[address - Controller1Address];
+      const auto data = (buffer & 0x80) > 0;
+      buffer <<= 1;
 
       return data;
     }
@@ -102,6 +152,14 @@ struct Nes{
   }
 
   auto mem_write(u16 address, u8 value){
+    if (address >= 0x8000 || in_range(address, PpuMemAddressRange)){
+      irq_dot = 0;
+    }
+
+    if constexpr (BankTracePolicy::Enabled){
+      cardridge.banks->trace.set_time(ppu.dot);
+    }
+
     if (cardridge.cpu_write(address, value)){
 
     }
@@ -117,7 +175,9 @@ struct Nes{
       dma_transfer_started = true;
     }
     else if (address == Controller1Address){
+      //The strobe latches both controllers, writes to $4017 go to the APU:
       controller_buffers[0] = controllers[0];
+      controller_buffers[1] = controllers[1];
     }
     else if (in_apu_range(address)){
       apu.cpu_write(address, value);
@@ -132,6 +192,18 @@ struct Nes{
     return ppu.mem_write(*this, address, value);
   }
 
+  //The IRQ line is level triggered, it stays up until the game acknowledges it through the mapper
+  auto poll_irq() -> void{
+    if (cardridge.irq_state()){
+      cpu.irq(*this);
+      irq_dot = ppu.dot;
+      return;
+    }
+
+    const auto edge_dot = ppu.a12_edge_dot(cardridge.irq_edges_remaining());
+    irq_dot = edge_dot == Ppu::NeverDot ? edge_dot : edge_dot + 1;
+  }
+
   auto cpu_clock(){
     if (!dma_transfer_started){
       cpu.clock(*this);
@@ -173,16 +245,16 @@ struct Nes{
       cpu.nmi(*this);
     }
 
-    auto audio_sample_ready = false;
-    audio_time += 1.0 / CyclesPerSec;
-    if (audio_time >= 1.0 / AudioSampleRate){
-      audio_time -= 1.0 / AudioSampleRate;
-      audio_sample_ready = true;
+    const auto audio_sample_ready = sample_clock.tick();
+    if (audio_sample_ready){
+      audio_sample = apu.output(sample_clock.time());
+      if (audio_sink){
+        audio_sink->push(audio_sample);
+      }
     }
 
-    if (cardridge.mapper->irq_state()){
-      cardridge.mapper->irq_clear();
-      cpu.irq(*this);
+    if (ppu.dot >= irq_dot){
+      poll_irq();
     }
 
     cycles++;
@@ -190,6 +262,65 @@ struct Nes{
     return audio_sample_ready;
   }
 
+  //Runs the emulator until 'frame_count' samples are mixed into 'output', calling 'on_cycle' after every clock
+  template<typename Callable>
+  auto render_audio(float* output, u32 frame_count, u32 channels, Callable on_cycle){
+    for (auto i : range(frame_count)){
+      auto sample = 0.f;
+      auto sample_ready = false;
+
+      while(!sample_ready && !paused){
+        sample_ready = clock();
+        on_cycle();
+      }
+
+      if (sample_ready){
+        sample = audio_sample;
+      }
+
+      for (auto channel : range(channels)){
+        output[i * channels + channel] = sample;
+      }
+    }
+  }
+
+  //Runs the emulator uncapped until 'sample_count' samples have been streamed into 'sink'
+  auto render_audio(AudioSink& sink, u32 sample_count){
+    auto previous_sink = audio_sink;
+    audio_sink = &sink;
+
+    for (auto i : range(sample_count)){
+      while(!clock()){}
+    }
+
+    sink.flush();
+    audio_sink = previous_sink;
+  }
+
+  //Clocks until the PPU finishes the current frame
+  auto run_frame(){
+    while(!ppu.frame_complete){
+      clock();
+    }
+
+    ppu.frame_complete = false;
+  }
+
+  //Independent instance in the same state, sharing the ROM image. For tree search and rollback:
+  //only mutable state is copied, the framebuffers too in visual mode. The copy has no audio sink
+  auto clone() const{
+    auto copy = std::make_unique<Nes>(*this);
+    copy->audio_sink = nullptr;
+
+    return copy;
+  }
+
+  //CRC32 of the last finished frame followed by the internal RAM, cheap enough to take every frame
+  auto frame_hash() const{
+    const auto crc = crc32(finished_framebuffer.bytes());
+    return crc32(Span<const u8>(ram.data(), CpuMemSize), crc);
+  }
+
   auto frame_complete(){
     return ppu.frame_complete;
   }
@@ -1,20 +1,14 @@
 #include "ppu.hpp"
-#include "GLFW/glfw3.h"
 #include "nes.hpp"
 #include "colors.hpp"
 #include "util.hpp"
 #include <cassert>
 #include <cstring> //For memset
+#include <algorithm>
 
 namespace nes{
 
-Ppu::Ppu(bool visual_mode) 
-  : texture1(ScreenSize, visual_mode), texture2(ScreenSize, visual_mode){
-  colors = get_colors();
-
-  texture1.scale = vec2(2.f);
-  texture2.scale = vec2(2.f);
-}
+const std::array<Framebuffer::pixel_color, 64> Ppu::colors = get_colors();
 
 auto Ppu::mem_read(const Nes& nes, u16 address) const -> u8{
   const auto cardridge_data = nes.cardridge.ppu_read(address);
@@ -100,7 +94,7 @@ static auto ppu_increment_address(Ppu& ppu){
   ppu.vram_address.data += increment_mode ? 32 : 1;
 }
 
-auto Ppu::cpu_read(const Nes& nes, u16 address) -> u8{
+auto Ppu::cpu_read(Nes& nes, u16 address) -> u8{
   address &= 0x0007;
 
   switch(address){
@@ -117,6 +111,7 @@ auto Ppu::cpu_read(const Nes& nes, u16 address) -> u8{
 
     case CpuDataPort:{
       auto data = data_buffer;
+      watch_a12(nes, vram_address.data);
       data_buffer = mem_read(nes, vram_address.data); 
 
       if (vram_address.data >= Ppu::PalettesAddressRange.first){
@@ -172,6 +167,7 @@ auto Ppu::cpu_write(Nes& nes, u16 address, u8 value) -> void{
         tram_address.data = (tram_address.data & 0xFF00) | value;
         vram_address.data = tram_address.data;
         address_latch = Ppu::AddressLatch::MSB;
+        watch_a12(nes, vram_address.data);
       }
       else{
         tram_address.data = (tram_address.data & 0x00FF) | u16((value & 0x3F) << 8);
@@ -180,6 +176,7 @@ auto Ppu::cpu_write(Nes& nes, u16 address, u8 value) -> void{
       break;
     }
     case CpuDataPort:
+      watch_a12(nes, vram_address.data);
       mem_write(nes, vram_address.data, value);
       ppu_increment_address(*this);
       break;
@@ -272,7 +269,103 @@ static auto ppu_update_shifters(Ppu& ppu){
   }
 }
 
-auto Ppu::clock(const Nes& nes) -> void{
+auto Ppu::rendering_enabled() const -> bool{
+  return mask.get(Mask::RenderBackground) || mask.get(Mask::RenderSprites);
+}
+
+//Tracks A12 of every address the PPU puts on the bus and reports filtered rising edges
+auto Ppu::watch_a12(Nes& nes, u16 address) -> void{
+  const auto high = (address & 0x1000) > 0;
+
+  if (high && !a12_high && dot - a12_low_since >= A12FilterDots){
+    nes.cardridge.clock_irq_counter();
+  }
+  else if (!high && a12_high){
+    a12_low_since = dot;
+  }
+
+  a12_high = high;
+}
+
+//Rendering fetch, the address only reaches the bus while rendering is enabled
+auto Ppu::fetch(Nes& nes, u16 address) -> u8{
+  if (rendering_enabled()){
+    watch_a12(nes, address);
+  }
+
+  return mem_read(nes, address);
+}
+
+auto Ppu::sprite_pattern_address(u8 slot) const -> u16{
+  const auto sprite_size_8x8 = control.get(Control::SpriteSize) == 0;
+
+  //Empty slots fetch tile $FF:
+  if (slot >= scanline_sprites_count){
+    return sprite_size_8x8 ? (control.get(Control::SpritePattern) << 12) | 0x0FF0 : 0x1FE0;
+  }
+
+  const auto& sprite = sprites_on_scanline[slot];
+  const auto flipped_vertically = (sprite.attribute & 0x80) > 0;
+
+  if (sprite_size_8x8){
+    const auto pattern_table = control.get(Control::SpritePattern) << 12;
+    const auto pattern_cell = sprite.id << 4;
+    const auto row_in_cell = scanline - sprite.y;
+
+    return pattern_table | pattern_cell | (flipped_vertically ? 7 - row_in_cell : row_in_cell);
+  }
+
+  const auto top_half = scanline - sprite.y < 8;
+  const auto pattern_table = (sprite.id & 0x01) << 12;
+  const auto top_half_pattern_cell = ((sprite.id & 0xFE)) << 4;
+  const auto bottom_half_pattern_cell = ((sprite.id & 0xFE) + 1) << 4;
+  const auto row_in_cell = ((scanline - sprite.y) & 0x07);
+
+  if (!flipped_vertically){
+    return pattern_table | (top_half ? top_half_pattern_cell : bottom_half_pattern_cell) | row_in_cell;
+  }
+  return pattern_table | (top_half ? bottom_half_pattern_cell : top_half_pattern_cell) | (7 - row_in_cell);
+}
+
+//Dot of the 'count'-th counted A12 rise from now, assuming PPUCTRL and PPUMASK stay the same.
+//With 8x8 sprites and the background and sprites on different pattern tables there is exactly one
+//per rendered line: at dot 261 (sprites at $1000) or 325 (background at $1000, plus one at dot 5
+//of the pre-render line). Other layouts depend on the tiles drawn, so the current dot is returned
+auto Ppu::a12_edge_dot(u32 count) const -> u64{
+  if (!rendering_enabled() || count == 0) return NeverDot;
+  if (control.get(Control::SpriteSize)) return dot;
+
+  const auto background_high = control.get(Control::BackgroundPattern);
+  if (background_high == control.get(Control::SpritePattern)){
+    return background_high ? dot : NeverDot;
+  }
+
+  const auto line_dots = u64(CyclesPerScanline + 1);
+  const auto frame_dots = (MaxScanlines + 2) * line_dots;
+
+  const auto lead = u64(background_high ? 1 : 0);
+  const auto edge_cycle = u64(background_high ? 325 : 261);
+  const auto edges_per_frame = lead + u64(ScreenSize.y) + 1;
+
+  //Position in dots from the start of the pre-render line:
+  const auto position = [&](u64 edge){
+    return edge < lead ? u64(5) : (edge - lead) * line_dots + edge_cycle;
+  };
+
+  const auto current = u64(scanline + 1) * line_dots + cycles;
+
+  auto first = u64(0);
+  if (lead > 0 && current > position(0)) first = 1;
+  if (current > position(first)) first = lead + (current - edge_cycle + line_dots - 1) / line_dots;
+  first = std::min(first, edges_per_frame);
+
+  const auto edge = first + count - 1;
+  const auto frames = edge / edges_per_frame;
+
+  return dot + frames * frame_dots + position(edge % edges_per_frame) - current;
+}
+
+auto Ppu::clock(Nes& nes) -> void{
   if (in_range(scanline, std::make_pair(-1, ScreenSize.y - 1))){
     if (scanline == -1 && cycles == 1){
       status.clear(Status::VBlank);
@@ -295,14 +388,14 @@ auto Ppu::clock(const Nes& nes) -> void{
       switch((cycles - 1) % 8){
         case 0:
           ppu_load_shifters(*this);
-          bg_next_tile_id = mem_read(nes, 
+          bg_next_tile_id = fetch(nes, 
             NametablesAddressRange.first |
             (vram_address.data & 0x0FFF)
           );
 
           break;
         case 2:
-          bg_next_tile_attribute = mem_read(nes, 
+          bg_next_tile_attribute = fetch(nes, 
             (NametablesAddressRange.first + 32 * 30)
             | (vram_address.props.nametable_y << 11)
             | (vram_address.props.nametable_x << 10)
@@ -316,14 +409,14 @@ auto Ppu::clock(const Nes& nes) -> void{
 
           break;
         case 4:
-          bg_next_tile_lsb = mem_read(nes, 
+          bg_next_tile_lsb = fetch(nes, 
             (background_pattern << 12) +
             (u16(bg_next_tile_id) << 4) +
             vram_address.props.cell_scroll_y
           );
           break;
         case 6:
-          bg_next_tile_msb = mem_read(nes, 
+          bg_next_tile_msb = fetch(nes, 
             (background_pattern << 12) +
             (u16(bg_next_tile_id) << 4) +
             vram_address.props.cell_scroll_y + 8
@@ -350,6 +443,10 @@ auto Ppu::clock(const Nes& nes) -> void{
 
     //Rendering Foreground
 
+    if (cycles == 257 && scanline == -1){
+      scanline_sprites_count = 0;
+    }
+
     if (cycles == 257 && scanline >= 0){
 			for (uint8_t i = 0; i < 8; i++) {
 				sprite_shifter_pattern_low[i] = 0;
@@ -388,61 +485,32 @@ auto Ppu::clock(const Nes& nes) -> void{
 
     }
 
-    if (cycles == 340){
-      u16 sprite_pattern_address_low = 0;
-
-      const auto sprite_size_8x8 = control.get(Control::SpriteSize) == 0;
-
-      for (auto i : range(scanline_sprites_count)){
-        const auto flipped_vertically = (sprites_on_scanline[i].attribute & 0x80) > 0;
-
-        if (sprite_size_8x8){
-          const auto pattern_table = control.get(Control::SpritePattern) << 12;
-          const auto pattern_cell = sprites_on_scanline[i].id << 4;
-          const auto row_in_cell = scanline - sprites_on_scanline[i].y;
-          //Check if not flipped:
-          sprite_pattern_address_low = pattern_table | pattern_cell;
+    //Sprite fetches, one 8 dot slot per sprite: two garbage nametable reads, then the pattern bytes
+    if (in_range(cycles, std::make_pair(257, 320))){
+      const auto slot = (cycles - 257) / 8;
+      const auto flipped_horizontally = slot < scanline_sprites_count && (sprites_on_scanline[slot].attribute & 0x40);
 
-          if (!flipped_vertically){
-            sprite_pattern_address_low |= row_in_cell;
+      switch((cycles - 257) % 8){
+        case 0:
+          if (rendering_enabled()){
+            watch_a12(nes, NametablesAddressRange.first | (vram_address.data & 0x0FFF));
           }
-          else{
-            sprite_pattern_address_low |= (7 - row_in_cell);
+          break;
+        case 4:{
+          const auto data = fetch(nes, sprite_pattern_address(slot));
+          if (slot < scanline_sprites_count){
+            sprite_shifter_pattern_low[slot] = flipped_horizontally ? flip_byte(data) : data;
           }
+          break;
         }
-        else{
-          const auto top_half = scanline - sprites_on_scanline[i].y < 8;
-          const auto pattern_table = (sprites_on_scanline[i].id & 0x01) << 12;
-          const auto top_half_pattern_cell = ((sprites_on_scanline[i].id & 0xFE)) << 4;
-          const auto bottom_half_pattern_cell = ((sprites_on_scanline[i].id & 0xFE) + 1) << 4;
-          const auto row_in_cell = ((scanline - sprites_on_scanline[i].y) & 0x07);
-
-          sprite_pattern_address_low = pattern_table;
-
-          if (!flipped_vertically){
-            sprite_pattern_address_low |= top_half ? top_half_pattern_cell : bottom_half_pattern_cell;
-            sprite_pattern_address_low |= row_in_cell;
-          }
-          else{
-            sprite_pattern_address_low |= top_half ? bottom_half_pattern_cell : top_half_pattern_cell;
-            sprite_pattern_address_low |= (7 - row_in_cell);
+        case 6:{
+          const auto data = fetch(nes, sprite_pattern_address(slot) + 8);
+          if (slot < scanline_sprites_count){
+            sprite_shifter_pattern_high[slot] = flipped_horizontally ? flip_byte(data) : data;
           }
+          break;
         }
-
-        u16 sprite_pattern_address_high = sprite_pattern_address_low + 8;
-        u8 sprite_pattern_data_low = mem_read(nes, sprite_pattern_address_low);
-        u8 sprite_pattern_data_high = mem_read(nes, sprite_pattern_address_high);
-
-        if (sprites_on_scanline[i].attribute & 0x40){
-          sprite_pattern_data_low = flip_byte(sprite_pattern_data_low);
-          sprite_pattern_data_high = flip_byte(sprite_pattern_data_high);
-        }
-
-        sprite_shifter_pattern_low[i] = sprite_pattern_data_low;
-        sprite_shifter_pattern_high[i] = sprite_pattern_data_high;
       }
-
-
     }
   }
 
@@ -456,6 +524,13 @@ auto Ppu::clock(const Nes& nes) -> void{
     }
   }
 
+  //Without a picture to produce, the pixel mux only matters for sprite 0 hit. Scanlines that can't
+  //have one skip it; sprite0_being_rendered is recomputed on every dot where it can matter
+  if (!composing && !sprite0hit_possible){
+    next_dot(nes);
+    return;
+  }
+
   u8 bg_palette = 0;
   u8 bg_pixel = 0;
   if (mask.get(Mask::RenderBackground)){
@@ -542,13 +617,19 @@ auto Ppu::clock(const Nes& nes) -> void{
     }
   }
 
+  if (composing){
+    nes.draw_framebuffer.set_pixel(
+      vec2(cycles - 1, scanline), 
+      colors[mem_read(nes, PalettesAddressRange.first + (palette << 2) + pixel) & 0x3F]
+    );
+  }
 
-  draw_texture->set_pixel(
-    vec2(cycles - 1, scanline), 
-    colors[mem_read(nes, PalettesAddressRange.first + (palette << 2) + pixel) & 0x3F]
-  );
+  next_dot(nes);
+}
 
+auto Ppu::next_dot(Nes& nes) -> void{
   cycles++;
+  dot++;
 
   if (cycles > Ppu::CyclesPerScanline){
     cycles = 0;
@@ -557,16 +638,35 @@ auto Ppu::clock(const Nes& nes) -> void{
     if (scanline > Ppu::MaxScanlines){
       scanline = -1;
       frame_complete = true;
-      std::swap(draw_texture, finished_texture);
+
+      //Skipped frames leave the last composed one in place:
+      if (composing){
+        std::swap(nes.draw_framebuffer, nes.finished_framebuffer);
+      }
+
+      frames++;
+      composing = composes_frame(frames);
 
       nes.render_request.send();
     }
   }
+}
 
-  if (mask.get(Mask::RenderBackground) || mask.get(Mask::RenderSprites)){
-    if (scanline < 240 && cycles == 324){
-      nes.cardridge.mapper->update_irq_counter(vram_address.data);
-    }
+auto Ppu::set_render_mode(RenderMode mode, u32 interval) -> void{
+  if (interval == 0){
+    throw std::runtime_error("Render interval must be at least 1");
+  }
+
+  render_mode = mode;
+  render_interval = interval;
+  composing = composes_frame(frames);
+}
+
+auto Ppu::composes_frame(u32 frame) const -> bool{
+  switch(render_mode){
+    case RenderMode::Full: return true;
+    case RenderMode::Skip: return frame % render_interval == 0;
+    default: return false;
   }
 }
 
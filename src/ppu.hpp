@@ -1,7 +1,7 @@
 #pragma once
 
 #include "aliases.hpp"
-#include "renderer/texture.hpp"
+#include "framebuffer.hpp"
 #include <array>
 #include <condition_variable>
 #include <mutex>
@@ -41,18 +41,17 @@ struct Ppu{
 
   static constexpr auto MaxSpritesOnScanline = 8;
 
-  Texture texture1;
-  Texture texture2;
-
-  Texture* finished_texture = &texture1;
-  Texture* draw_texture = &texture2;
+  //MMC3 ignores A12 rises unless the line was low for a few CPU cycles, this hides the short
+  //nametable fetches between pattern fetches
+  static constexpr auto A12FilterDots = 12;
+  static constexpr auto NeverDot = ~u64(0);
 
   u8 current_palette = 0;
   bool sprite0hit_occured = false;
 
-  u8 nametables[2][32 * 32];
-  u8 palettes[PalettesCount * PaletteSize];
-  std::array<Texture::pixel_color, 64> colors;
+  u8 nametables[2][32 * 32]{};
+  u8 palettes[PalettesCount * PaletteSize]{};
+  static const std::array<Framebuffer::pixel_color, 64> colors;
 
   enum class Status{
     SpriteOverflow = (1 << 5),
@@ -82,6 +81,13 @@ struct Ppu{
     EnableNmi = (1 << 7)
   };
 
+  //How much of the picture is produced. What the game sees is the same in every mode
+  enum class RenderMode : u8{
+    Full,      //Every frame is composed
+    Skip,      //Every 'render_interval'th frame is composed, the finished frame stays until the next one
+    TimingOnly //No pixels, only sprite 0 hit, sprite overflow, VBlank/NMI and the A12 fetches for mapper IRQs
+  };
+
   enum class AddressLatch{
     LSB,
     MSB
@@ -113,8 +119,8 @@ struct Ppu{
 
   u8 oam_address = 0;
 
-  u8 sprite_shifter_pattern_low[MaxSpritesOnScanline];
-  u8 sprite_shifter_pattern_high[MaxSpritesOnScanline];
+  u8 sprite_shifter_pattern_low[MaxSpritesOnScanline]{};
+  u8 sprite_shifter_pattern_high[MaxSpritesOnScanline]{};
 
   //Registers:
   Register<u8, Control> control;
@@ -141,6 +147,13 @@ struct Ppu{
   i32 cycles = 0;
   i32 scanline = 0;
   bool frame_complete = false;
+
+  RenderMode render_mode = RenderMode::Full;
+  u32 render_interval = 1;
+
+  //Frames completed since power-on, and whether the current one is being composed:
+  u32 frames = 0;
+  bool composing = true;
   bool palettes_started_loading = false;
 
   bool sprite0hit_possible = false;
@@ -148,12 +161,28 @@ struct Ppu{
 
   bool nmi = false;
 
-  Ppu(bool visual_mode = true);
+  //Dots clocked since power-on:
+  u64 dot = 0;
+
+  bool a12_high = false;
+  u64 a12_low_since = 0;
+
   auto mem_read(const Nes& nes, u16 address) const -> u8;
   auto mem_write(Nes& nes, u16 address, u8 value) -> void;
-  auto cpu_read(const Nes& nes, u16 address) -> u8;
+  auto cpu_read(Nes& nes, u16 address) -> u8;
   auto cpu_write(Nes& nes, u16 address, u8 value) -> void;
-  auto clock(const Nes& nes) -> void;
+  auto clock(Nes& nes) -> void;
+  auto next_dot(Nes& nes) -> void;
+
+  //Takes effect from the current frame on, a frame switched to mid-way is only partly drawn
+  auto set_render_mode(RenderMode mode, u32 interval = 1) -> void;
+  auto composes_frame(u32 frame) const -> bool;
+
+  auto rendering_enabled() const -> bool;
+  auto watch_a12(Nes& nes, u16 address) -> void;
+  auto fetch(Nes& nes, u16 address) -> u8;
+  auto sprite_pattern_address(u8 slot) const -> u16;
+  auto a12_edge_dot(u32 count) const -> u64;
 
   auto set_loopy_reg(u16& reg, u16 data) -> void;
   auto get_loopy_reg(u16& reg) -> void;
@@ -2,6 +2,7 @@
 
 #include "../aliases.hpp"
 #include "../util.hpp"
+#include "../framebuffer.hpp"
 #include <glad/glad.h>
 #include <cstring>
 
@@ -344,7 +345,7 @@ struct Texture{
     0,0,0,0,0,0,0,0,
   };
 
-  using pixel_color = vec<u8, 3>;
+  using pixel_color = Framebuffer::pixel_color;
 
   std::vector<pixel_color> pixels;
   pixel_color text_color = pixel_color(255, 255, 255);
@@ -380,6 +381,12 @@ struct Texture{
     pixels[y * size.x + x] = color;
   }
 
+  //Takes the pixels of a frame drawn by the emulator, they are sent to the GPU on the next render
+  auto copy(const Framebuffer& framebuffer){
+    if (framebuffer.pixels.size() != pixels.size()) return;
+    std::memcpy(pixels.data(), framebuffer.pixels.data(), pixels.size() * sizeof(pixels[0]));
+  }
+
   auto clear(){
     std::memset(pixels.data(), 0, pixels.size() * sizeof(pixels[0]));
   }
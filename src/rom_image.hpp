@@ -0,0 +1,213 @@
+#pragma once
+
+#include "aliases.hpp"
+#include "util.hpp"
+#include "mapped_file.hpp"
+#include "archive.hpp"
+#include <string>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <cstring>
+#include <algorithm>
+
+namespace nes{
+
+struct CardridgeHeader{
+  u8 name[4];
+  u8 program_rom_chunks;
+  u8 char_rom_chunks;
+  u8 mapper1;
+  u8 mapper2;
+  u8 program_ram_size;
+  u8 tv_system1;
+  u8 tv_system2;
+  u8 unused[5];
+
+  auto has_magic() const{
+    return name[0] == 'N' && name[1] == 'E' && name[2] == 'S' && name[3] == 0x1A;
+  }
+
+  auto is_nes2() const{
+    return (mapper2 & 0x0C) == 0x08;
+  }
+
+  auto has_battery() const{
+    return (mapper1 & 0x02) > 0;
+  }
+
+  auto has_trainer() const{
+    return (mapper1 & 0x04) > 0;
+  }
+
+  auto mapper_id() const{
+    const auto id = (mapper2 & 0b11110000) | (mapper1 >> 4);
+    return is_nes2() ? id | ((program_ram_size & 0x0F) << 8) : id;
+  }
+
+  //NES 2.0 only fields, the bytes are unused (or garbage) in plain iNES files:
+
+  auto submapper() const -> u8{
+    return is_nes2() ? program_ram_size >> 4 : 0;
+  }
+
+  static auto nes2_rom_size(u8 lsb, u8 msb, u32 unit) -> u64{
+    //With the MSB nibble set to $F the size is written as 2^E * (M * 2 + 1)
+    if (msb == 0x0F){
+      return (u64(1) << (lsb >> 2)) * ((lsb & 0x03) * 2 + 1);
+    }
+    return u64((msb << 8) | lsb) * unit;
+  }
+
+  auto program_rom_size() const -> u64{
+    if (!is_nes2()) return program_rom_chunks * 16_kb;
+    return nes2_rom_size(program_rom_chunks, tv_system1 & 0x0F, 16_kb);
+  }
+
+  auto char_rom_size() const -> u64{
+    if (!is_nes2()) return char_rom_chunks * 8_kb;
+    return nes2_rom_size(char_rom_chunks, tv_system1 >> 4, 8_kb);
+  }
+
+  static auto nes2_ram_size(u8 shift) -> u32{
+    return shift == 0 ? 0 : 64 << shift;
+  }
+
+  //Volatile and battery-backed PRG-RAM:
+  auto program_ram_bytes() const -> u32{
+    if (!is_nes2()) return program_ram_size == 0 ? 8_kb : program_ram_size * 8_kb;
+    return nes2_ram_size(tv_system2 & 0x0F) + nes2_ram_size(tv_system2 >> 4);
+  }
+
+  auto char_ram_bytes() const -> u32{
+    if (!is_nes2()) return char_rom_chunks == 0 ? 8_kb : 0;
+    return nes2_ram_size(unused[0] & 0x0F) + nes2_ram_size(unused[0] >> 4);
+  }
+
+  //0: NTSC, 1: PAL, 2: multi-region, 3: Dendy
+  auto timing() const -> u8{
+    if (!is_nes2()) return tv_system1 & 0x01;
+    return unused[1] & 0x03;
+  }
+};
+
+//Parsed iNES image. It never changes after loading, so every Nes instance running the same
+//game attaches to one shared copy and keeps only its mutable state private
+struct RomImage{
+  static constexpr auto HeaderSize = sizeof(CardridgeHeader);
+  static constexpr auto TrainerSize = 512;
+
+  CardridgeHeader header;
+  std::string game_name;
+
+  //Battery-backed RAM is kept next to the ROM, with the extension replaced by ".sav":
+  std::string save_path;
+
+  //PRG-ROM and CHR-ROM point straight into the read-only mapping of the file, or into 'buffer'
+  //when the ROM was inflated from a .zip or .gz archive:
+  MappedFile file;
+  std::vector<u8> buffer;
+  Span<const u8> program_rom;
+  Span<const u8> char_rom;
+
+  RomImage(const std::string& filepath) 
+  : game_name(get_game_name(filepath)), save_path(remove_extension(filepath) + ".sav"), file(filepath){
+    auto image = file.bytes();
+
+    if (Archive::is_archive(image)){
+      buffer = Archive::extract(image, filepath);
+      image = buffer;
+      file.unmap();
+    }
+
+    if (image.size() < HeaderSize){
+      throw std::runtime_error("Invalid ROM file: " + filepath);
+    }
+
+    std::memcpy(&header, image.data(), HeaderSize);
+    if (!header.has_magic()){
+      throw std::runtime_error("Invalid ROM file: " + filepath);
+    }
+
+    auto offset = HeaderSize;
+    if (header.has_trainer()){
+      offset += TrainerSize;
+    }
+
+    const auto program_size = header.program_rom_size();
+    const auto char_size = header.char_rom_size();
+
+    if (program_size == 0 || image.size() < offset + program_size + char_size){
+      throw std::runtime_error("Invalid ROM file: " + filepath);
+    }
+
+    program_rom = image.subspan(offset, program_size);
+    char_rom = image.subspan(offset + program_size, char_size);
+  }
+
+  RomImage(const RomImage&) = delete;
+  auto operator=(const RomImage&) -> RomImage& = delete;
+
+  auto mapper_id() const{
+    return header.mapper_id();
+  }
+
+  static auto remove_single_extension(const std::string& filepath) -> std::string{
+    const auto dot_pos = filepath.rfind('.');
+    const auto slash_pos = filepath.find_last_of("/\\");
+
+    if (dot_pos == std::string::npos || (slash_pos != std::string::npos && dot_pos < slash_pos)){
+      return filepath;
+    }
+    return filepath.substr(0, dot_pos);
+  }
+
+  static auto has_rom_extension(const std::string& filepath){
+    auto extension = filepath.substr(remove_single_extension(filepath).size());
+    std::transform(extension.begin(), extension.end(), extension.begin(), [](char c){ return std::tolower(c); });
+
+    return extension == ".nes" || extension == ".zip" || extension == ".gz";
+  }
+
+  //"game.nes", "game.zip" and "game.nes.gz" all become "game":
+  static auto remove_extension(const std::string& filepath) -> std::string{
+    auto extension = filepath.substr(remove_single_extension(filepath).size());
+    std::transform(extension.begin(), extension.end(), extension.begin(), [](char c){ return std::tolower(c); });
+
+    const auto path = remove_single_extension(filepath);
+    if (extension == ".gz" && Archive::has_rom_extension(path)){
+      return remove_single_extension(path);
+    }
+    return path;
+  }
+
+  static auto get_game_name(const std::string& filepath) -> std::string{
+    const auto name = remove_extension(filepath);
+    const auto slash_pos = name.find_last_of("/\\");
+
+    if (slash_pos == std::string::npos){
+      return name;
+    }
+    return name.substr(slash_pos + 1);
+  }
+
+  //Images stay cached for as long as some instance holds them
+  static auto load(const std::string& filepath) -> std::shared_ptr<const RomImage>{
+    static std::mutex mtx;
+    static std::unordered_map<std::string, std::weak_ptr<const RomImage>> cache;
+
+    auto lock = std::lock_guard(mtx);
+
+    auto& cached = cache[filepath];
+    if (auto image = cached.lock()){
+      return image;
+    }
+
+    auto image = std::make_shared<const RomImage>(filepath);
+    cached = image;
+
+    return image;
+  }
+};
+
+} //namespace nes
@@ -0,0 +1,548 @@
+#pragma once
+
+#include "aliases.hpp"
+#include "util.hpp"
+#include "nes.hpp"
+#include "audio_sink.hpp"
+#include "thread_pool.hpp"
+#include <string>
+#include <vector>
+#include <map>
+#include <memory>
+#include <atomic>
+#include <utility>
+#include <new>
+#include <cstring>
+#include <stdexcept>
+#include <exception>
+
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+
+namespace nes{
+
+//Control messages over the session socket. Both ends run on the same machine, so fields are
+//in native byte order; 'size' payload bytes follow each header
+struct ServerMessage{
+  enum Type : u32{
+    LoadRom,   //Payload: ROM path. Reply payload: name of the session's FrameRing
+    Step,      //Argument: frames to run. Reply argument: frames published so far
+    SetInput,  //Argument: controller 1 in the low byte, controller 2 in the high byte
+    SaveState, //Argument: slot, kept by the server
+    LoadState, //Argument: slot
+    Close
+  };
+
+  u32 type = 0;
+  u32 argument = 0;
+  u32 size = 0;
+};
+
+struct ServerReply{
+  enum Status : u32{
+    Ok,
+    Error //Payload: error message
+  };
+
+  u32 status = Ok;
+  u32 argument = 0;
+  u32 size = 0;
+};
+
+//Shared memory every session publishes its frames into, so no pixel data goes through the socket.
+//Frame n lands in slot n % SlotCount and 'frames_written' is bumped after the slot is complete.
+//A client reading after its Step reply sees the last SlotCount frames of that step
+struct FrameRing{
+  static constexpr auto Magic = u32(0x474E4952);
+  static constexpr auto SlotCount = 8;
+  static constexpr auto MaxAudioSamples = AudioSink::BlockSize;
+  static constexpr auto PixelBytes = 256 * 240 * 3;
+
+  struct Slot{
+    u64 frame; //Frames the session's instance ran since power-on, rewinds with LoadState
+    u32 hash;
+    u32 audio_count;
+    u8 pixels[PixelBytes];
+    u8 ram[Nes::CpuMemSize];
+    float audio[MaxAudioSamples];
+  };
+
+  struct Layout{
+    u32 magic;
+    u32 slot_count;
+    std::atomic<u64> frames_written;
+    Slot slots[SlotCount];
+  };
+
+  static_assert(std::atomic<u64>::is_always_lock_free, "The frame counter is shared between processes");
+
+  Layout* layout = nullptr;
+  std::string name;
+  bool owner = false;
+
+  FrameRing() {}
+
+  FrameRing(const FrameRing&) = delete;
+  auto operator=(const FrameRing&) -> FrameRing& = delete;
+
+  FrameRing(FrameRing&& other){
+    *this = std::move(other);
+  }
+
+  auto operator=(FrameRing&& other) -> FrameRing&{
+    if (this == &other) return *this;
+
+    release();
+    layout = std::exchange(other.layout, nullptr);
+    name = std::move(other.name);
+    owner = std::exchange(other.owner, false);
+
+    return *this;
+  }
+
+  static auto map(const std::string& name, i32 flags) -> Layout*{
+    const auto fd = ::shm_open(name.c_str(), flags, 0600);
+    if (fd < 0){
+      throw std::runtime_error("Unable to open shared memory: " + name);
+    }
+
+    if ((flags & O_CREAT) && ::ftruncate(fd, sizeof(Layout)) != 0){
+      ::close(fd);
+      throw std::runtime_error("Unable to size shared memory: " + name);
+    }
+
+    const auto mapping = ::mmap(nullptr, sizeof(Layout), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    ::close(fd);
+
+    if (mapping == MAP_FAILED){
+      throw std::runtime_error("Unable to map shared memory: " + name);
+    }
+
+    return static_cast<Layout*>(mapping);
+  }
+
+  //Server side, the name is removed again when the ring is destroyed
+  static auto create(const std::string& name){
+    auto ring = FrameRing();
+    ring.layout = map(name, O_CREAT | O_EXCL | O_RDWR);
+    ring.name = name;
+    ring.owner = true;
+
+    ring.layout->magic = Magic;
+    ring.layout->slot_count = SlotCount;
+    new (&ring.layout->frames_written) std::atomic<u64>(0);
+
+    return ring;
+  }
+
+  //Client side
+  static auto open(const std::string& name){
+    auto ring = FrameRing();
+    ring.layout = map(name, O_RDWR);
+    ring.name = name;
+
+    if (ring.layout->magic != Magic || ring.layout->slot_count != SlotCount){
+      throw std::runtime_error("Shared memory is not a frame ring: " + name);
+    }
+
+    return ring;
+  }
+
+  auto frames_written() const -> u64{
+    return layout->frames_written.load(std::memory_order_acquire);
+  }
+
+  auto slot(u64 index) const -> const Slot&{
+    return layout->slots[index % SlotCount];
+  }
+
+  //Most recent frame, only valid once a frame was written
+  auto latest() const -> const Slot&{
+    return slot(frames_written() - 1);
+  }
+
+  auto publish(const Nes& nes, u64 frame, const std::vector<float>& audio){
+    const auto index = layout->frames_written.load(std::memory_order_relaxed);
+    auto& slot = layout->slots[index % SlotCount];
+
+    const auto pixels = nes.finished_framebuffer.bytes();
+    const auto audio_count = std::min<u32>(audio.size(), MaxAudioSamples);
+
+    slot.frame = frame;
+    slot.hash = nes.frame_hash();
+    slot.audio_count = audio_count;
+    std::memcpy(slot.pixels, pixels.data(), std::min<u32>(pixels.size(), PixelBytes));
+    std::memcpy(slot.ram, nes.ram.data(), Nes::CpuMemSize);
+    std::memcpy(slot.audio, audio.data(), audio_count * sizeof(float));
+
+    layout->frames_written.store(index + 1, std::memory_order_release);
+  }
+
+  auto release() -> void{
+    if (layout != nullptr){
+      ::munmap(layout, sizeof(Layout));
+    }
+
+    if (owner){
+      ::shm_unlink(name.c_str());
+    }
+
+    layout = nullptr;
+    owner = false;
+  }
+
+  ~FrameRing(){
+    release();
+  }
+};
+
+//Whole-buffer socket transfers, false once the peer is gone
+inline auto send_all(i32 fd, const void* data, u32 size){
+  auto bytes = static_cast<const u8*>(data);
+
+  while (size > 0){
+    const auto sent = ::send(fd, bytes, size, MSG_NOSIGNAL);
+    if (sent <= 0) return false;
+
+    bytes += sent;
+    size -= sent;
+  }
+
+  return true;
+}
+
+inline auto receive_all(i32 fd, void* data, u32 size){
+  auto bytes = static_cast<u8*>(data);
+
+  while (size > 0){
+    const auto received = ::recv(fd, bytes, size, 0);
+    if (received <= 0) return false;
+
+    bytes += received;
+    size -= received;
+  }
+
+  return true;
+}
+
+inline auto socket_address(const std::string& socket_path){
+  auto address = sockaddr_un();
+  address.sun_family = AF_UNIX;
+
+  if (socket_path.size() >= sizeof(address.sun_path)){
+    throw std::runtime_error("Socket path too long: " + socket_path);
+  }
+
+  std::strcpy(address.sun_path, socket_path.c_str());
+  return address;
+}
+
+//One connected client and the instance it drives
+struct ServerSession{
+  struct SavedState{
+    std::unique_ptr<Nes> nes;
+    u64 frame = 0;
+  };
+
+  i32 fd;
+  FrameRing ring;
+  MemoryAudioSink audio;
+
+  std::unique_ptr<Nes> nes;
+  std::map<u32, SavedState> states;
+  u16 input = 0;
+  u64 frame = 0;
+
+  //Set while a pool task owns the session, the socket isn't polled meanwhile:
+  std::atomic<bool> busy = false;
+  bool closing = false;
+
+  ServerSession(i32 fd, const std::string& ring_name) : fd(fd), ring(FrameRing::create(ring_name)) {}
+
+  ~ServerSession(){
+    ::close(fd);
+  }
+
+  auto require_rom() const -> Nes&{
+    if (nes == nullptr){
+      throw std::runtime_error("No ROM loaded");
+    }
+    return *nes;
+  }
+
+  auto handle(const ServerMessage& message, const std::string& payload) -> std::pair<ServerReply, std::string>{
+    auto reply = ServerReply();
+
+    try{
+      switch(message.type){
+        case ServerMessage::LoadRom:
+          //Sessions get private battery RAM, clients of one ROM can't corrupt each other's PRG-RAM
+          //and states stay self-contained:
+          nes = std::make_unique<Nes>();
+          nes->load_cardridge(payload);
+          nes->audio_sink = &audio;
+          frame = 0;
+          return { reply, ring.name };
+
+        case ServerMessage::Step:{
+          auto& nes = require_rom();
+
+          for (auto i : range(message.argument)){
+            nes.controllers[0] = input & 0xFF;
+            nes.controllers[1] = input >> 8;
+            nes.run_frame();
+            frame++;
+
+            audio.flush();
+            ring.publish(nes, frame, audio.samples);
+            audio.samples.clear();
+          }
+
+          reply.argument = u32(ring.frames_written());
+          return { reply, "" };
+        }
+
+        case ServerMessage::SetInput:
+          input = message.argument;
+          return { reply, "" };
+
+        case ServerMessage::SaveState:
+          states[message.argument] = SavedState{ require_rom().clone(), frame };
+          return { reply, "" };
+
+        case ServerMessage::LoadState:{
+          const auto state = states.find(message.argument);
+          if (state == states.end()){
+            throw std::runtime_error("No state in slot " + std::to_string(message.argument));
+          }
+
+          nes = state->second.nes->clone();
+          nes->audio_sink = &audio;
+          frame = state->second.frame;
+          return { reply, "" };
+        }
+
+        case ServerMessage::Close:
+          closing = true;
+          return { reply, "" };
+
+        default:
+          throw std::runtime_error("Unknown message " + std::to_string(message.type));
+      }
+    }
+    //Anything a session throws becomes an error reply, never a dead server:
+    catch(const std::exception& error){
+      reply.status = ServerReply::Error;
+      return { reply, error.what() };
+    }
+  }
+};
+
+//Hosts one session per connection on a Unix domain socket. A single thread polls the sockets and
+//reads requests; each request then runs as a pool task that writes its own reply, so sessions
+//step in parallel and a long Step never blocks the others
+struct Server{
+  std::string socket_path;
+  ThreadPool pool;
+
+  i32 listen_fd = -1;
+  i32 wake_pipe[2]{ -1, -1 };
+
+  std::map<i32, std::unique_ptr<ServerSession>> sessions;
+  u32 next_session = 0;
+  std::atomic<bool> stopping = false;
+
+  Server(const std::string& socket_path, u32 thread_count = ThreadPool::default_thread_count())
+  : socket_path(socket_path), pool(thread_count){
+    const auto address = socket_address(socket_path);
+    ::unlink(socket_path.c_str());
+
+    listen_fd = ::socket(AF_UNIX, SOCK_STREAM, 0);
+    if (listen_fd < 0 || ::bind(listen_fd, reinterpret_cast<const sockaddr*>(&address), sizeof(address)) != 0
+      || ::listen(listen_fd, 16) != 0 || ::pipe(wake_pipe) != 0){
+      throw std::runtime_error("Unable to listen on " + socket_path);
+    }
+  }
+
+  Server(const Server&) = delete;
+  auto operator=(const Server&) -> Server& = delete;
+
+  //Makes run() return, safe from other threads and signal handlers
+  auto stop(){
+    stopping = true;
+    wake();
+  }
+
+  auto wake() -> void{
+    const auto byte = u8(0);
+    [[maybe_unused]] const auto written = ::write(wake_pipe[1], &byte, 1);
+  }
+
+  auto accept_session(){
+    const auto fd = ::accept(listen_fd, nullptr, nullptr);
+    if (fd < 0) return;
+
+    const auto ring_name = "/nes_" + std::to_string(::getpid()) + "_" + std::to_string(next_session++);
+
+    //Without a frame ring (a stale name, a full /dev/shm) only this client is turned away:
+    try{
+      sessions[fd] = std::make_unique<ServerSession>(fd, ring_name);
+    }
+    catch(const std::exception&){
+      sessions.erase(fd);
+      ::close(fd);
+    }
+  }
+
+  //Reads one request on the polling thread and hands it to the pool. False when the client is gone
+  auto dispatch(ServerSession& session) -> bool{
+    auto message = ServerMessage();
+    if (!receive_all(session.fd, &message, sizeof(message))) return false;
+
+    auto payload = std::string(message.size, '\0');
+    if (!receive_all(session.fd, payload.data(), message.size)) return false;
+
+    session.busy = true;
+    pool.submit([this, &session, message, payload = std::move(payload)]{
+      auto [reply, reply_payload] = session.handle(message, payload);
+      reply.size = reply_payload.size();
+
+      if (!send_all(session.fd, &reply, sizeof(reply)) || !send_all(session.fd, reply_payload.data(), reply.size)){
+        session.closing = true;
+      }
+
+      session.busy = false;
+      wake();
+    });
+
+    return true;
+  }
+
+  auto run(){
+    while (!stopping){
+      auto fds = std::vector<pollfd>{ { listen_fd, POLLIN, 0 }, { wake_pipe[0], POLLIN, 0 } };
+
+      for (auto session = sessions.begin(); session != sessions.end();){
+        if (session->second->busy){
+          ++session;
+        }
+        else if (session->second->closing){
+          session = sessions.erase(session);
+        }
+        else{
+          fds.push_back({ session->first, POLLIN, 0 });
+          ++session;
+        }
+      }
+
+      if (::poll(fds.data(), fds.size(), -1) < 0) continue;
+
+      if (fds[1].revents & POLLIN){
+        u8 buffer[64];
+        [[maybe_unused]] const auto drained = ::read(wake_pipe[0], buffer, sizeof(buffer));
+      }
+
+      if (fds[0].revents & POLLIN){
+        accept_session();
+      }
+
+      for (auto i : range(2, fds.size())){
+        if (fds[i].revents == 0) continue;
+
+        auto& session = *sessions[fds[i].fd];
+        if (!(fds[i].revents & POLLIN) || !dispatch(session)){
+          session.closing = true;
+        }
+      }
+    }
+  }
+
+  ~Server(){
+    pool.wait();
+    sessions.clear();
+
+    ::close(listen_fd);
+    ::close(wake_pipe[0]);
+    ::close(wake_pipe[1]);
+    ::unlink(socket_path.c_str());
+  }
+};
+
+//Blocking client for the protocol above, requests fail with std::runtime_error
+struct ServerClient{
+  i32 fd = -1;
+  FrameRing ring;
+
+  ServerClient(const std::string& socket_path){
+    const auto address = socket_address(socket_path);
+
+    fd = ::socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0 || ::connect(fd, reinterpret_cast<const sockaddr*>(&address), sizeof(address)) != 0){
+      if (fd >= 0) ::close(fd);
+      throw std::runtime_error("Unable to connect to " + socket_path);
+    }
+  }
+
+  ServerClient(const ServerClient&) = delete;
+  auto operator=(const ServerClient&) -> ServerClient& = delete;
+
+  auto request(u32 type, u32 argument = 0, const std::string& payload = "") -> std::pair<ServerReply, std::string>{
+    const auto message = ServerMessage{ type, argument, u32(payload.size()) };
+    auto reply = ServerReply();
+
+    if (!send_all(fd, &message, sizeof(message)) || !send_all(fd, payload.data(), payload.size())
+      || !receive_all(fd, &reply, sizeof(reply))){
+      throw std::runtime_error("Connection to the server lost");
+    }
+
+    auto reply_payload = std::string(reply.size, '\0');
+    if (!receive_all(fd, reply_payload.data(), reply.size)){
+      throw std::runtime_error("Connection to the server lost");
+    }
+
+    if (reply.status != ServerReply::Ok){
+      throw std::runtime_error(reply_payload);
+    }
+
+    return { reply, reply_payload };
+  }
+
+  auto load_rom(const std::string& filepath){
+    const auto ring_name = request(ServerMessage::LoadRom, 0, filepath).second;
+    if (ring.name != ring_name){
+      ring = FrameRing::open(ring_name);
+    }
+  }
+
+  //Returns the number of frames published to the ring so far
+  auto step(u32 frames = 1){
+    return request(ServerMessage::Step, frames).first.argument;
+  }
+
+  auto set_input(u16 buttons){
+    request(ServerMessage::SetInput, buttons);
+  }
+
+  auto save_state(u32 slot){
+    request(ServerMessage::SaveState, slot);
+  }
+
+  auto load_state(u32 slot){
+    request(ServerMessage::LoadState, slot);
+  }
+
+  ~ServerClient(){
+    if (fd < 0) return;
+
+    const auto message = ServerMessage{ ServerMessage::Close };
+    send_all(fd, &message, sizeof(message));
+    ::close(fd);
+  }
+};
+
+} //namespace nes
@@ -0,0 +1,127 @@
+#pragma once
+
+#include "aliases.hpp"
+#include "util.hpp"
+#include "nes.hpp"
+#include "rom_image.hpp"
+#include "library.hpp"
+#include "thread_pool.hpp"
+#include <string>
+#include <vector>
+#include <memory>
+#include <chrono>
+#include <filesystem>
+#include <exception>
+#include <stdexcept>
+
+namespace nes{
+
+//Outcome of running one ROM headless for a fixed number of frames
+struct SweepResult{
+  enum class Status{
+    Ok,
+    UnsupportedMapper,
+    UnsupportedOpcode,
+    Error
+  };
+
+  std::string path;
+  Status status = Status::Ok;
+  std::string message;
+
+  i32 mapper = -1;
+  u32 frames = 0;
+  double seconds = 0.0;
+
+  //PC of the instruction that was executing when emulation failed:
+  bool failed_in_cpu = false;
+  u16 failing_pc = 0;
+
+  //Nes::frame_hash after the last frame that ran:
+  u32 hash = 0;
+
+  auto fps() const{
+    return seconds > 0.0 ? frames / seconds : 0.0;
+  }
+
+  static auto status_name(Status status) -> const char*{
+    switch(status){
+      case Status::Ok: return "ok";
+      case Status::UnsupportedMapper: return "unsupported_mapper";
+      case Status::UnsupportedOpcode: return "unsupported_opcode";
+      default: return "error";
+    }
+  }
+};
+
+//Every ROM gets its own instance from power-on, so one failing title can't affect the others.
+//Battery RAM is private and starts empty: the sweep never writes .sav files into the library and
+//battery titles hash the same on every run
+inline auto sweep_rom(const std::string& path, u32 frames, Ppu::RenderMode render_mode = Ppu::RenderMode::Full) -> SweepResult{
+  auto result = SweepResult();
+  result.path = path;
+
+  auto nes = std::make_unique<Nes>(render_mode != Ppu::RenderMode::TimingOnly);
+  auto loaded = false;
+  const auto start = std::chrono::steady_clock::now();
+
+  try{
+    nes->ppu.set_render_mode(render_mode);
+    nes->load_cardridge(path);
+    loaded = true;
+
+    for (auto frame : range(frames)){
+      nes->run_frame();
+      result.frames++;
+    }
+  }
+  catch(const std::exception& error){
+    //Not only runtime errors, a malformed image must not take the whole sweep down:
+    result.message = error.what();
+
+    if (result.message.find("Unsupported mapper") != std::string::npos){
+      result.status = SweepResult::Status::UnsupportedMapper;
+    }
+    else if (result.message.find("Unsupported opcode") != std::string::npos){
+      result.status = SweepResult::Status::UnsupportedOpcode;
+    }
+    else{
+      result.status = SweepResult::Status::Error;
+    }
+
+    result.failed_in_cpu = loaded;
+    result.failing_pc = nes->cpu.instruction_pc;
+  }
+
+  result.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+  //The header is known as soon as the image parsed, even when its mapper isn't supported:
+  if (nes->cardridge.rom != nullptr){
+    result.mapper = nes->cardridge.header.mapper_id();
+  }
+
+  if (loaded){
+    result.hash = nes->frame_hash();
+  }
+
+  return result;
+}
+
+//ROMs under 'directory' in path order, each swept as its own pool task
+inline auto sweep_directory(const std::string& directory, u32 frames, ThreadPool& pool, Ppu::RenderMode render_mode = Ppu::RenderMode::Full){
+  if (!std::filesystem::is_directory(directory)){
+    throw std::runtime_error("Not a directory: " + directory);
+  }
+
+  const auto paths = Library::find_roms(directory);
+
+  auto results = std::vector<SweepResult>(paths.size());
+  for (auto i : range(paths.size())){
+    pool.submit([&, i]{ results[i] = sweep_rom(paths[i], frames, render_mode); });
+  }
+  pool.wait();
+
+  return results;
+}
+
+} //namespace nes
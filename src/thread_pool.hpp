@@ -0,0 +1,194 @@
+#pragma once
+
+#include "aliases.hpp"
+#include <vector>
+#include <deque>
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <exception>
+#include <utility>
+
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+namespace nes{
+
+//Work-stealing pool. Every worker owns a deque: it takes its newest task first and, when its
+//own deque is empty, steals the oldest task of another worker. Tasks submitted from a worker
+//stay on that worker, outside tasks are dealt round-robin
+struct ThreadPool{
+  using task_t = std::function<void()>;
+
+  struct Queue{
+    std::mutex mtx;
+    std::deque<task_t> tasks;
+  };
+
+  std::vector<std::thread> threads;
+  std::vector<std::unique_ptr<Queue>> queues;
+
+  //Guards sleeping and waking, 'queued' only grows while it is held so no wakeup is lost:
+  std::mutex mtx;
+  std::condition_variable task_available;
+  std::condition_variable all_done;
+
+  std::atomic<u32> queued = 0;
+  std::atomic<u32> pending = 0;
+  std::atomic<u32> next_queue = 0;
+  bool stopping = false;
+
+  //First exception thrown by a task since the last wait(), guarded by 'mtx':
+  std::exception_ptr error;
+
+  static auto default_thread_count() -> u32{
+    const auto count = std::thread::hardware_concurrency();
+    return count > 0 ? count : 1;
+  }
+
+  //Index of the calling worker in its pool, -1 outside of workers
+  static auto worker_index() -> i32&{
+    static thread_local auto index = i32(-1);
+    return index;
+  }
+
+  //'pin_threads' binds worker i to core i, so an instance keeps its caches between frame quanta
+  ThreadPool(u32 thread_count = default_thread_count(), bool pin_threads = false){
+    thread_count = thread_count > 0 ? thread_count : 1;
+
+    for (auto i : range(thread_count)){
+      queues.push_back(std::make_unique<Queue>());
+    }
+
+    for (auto i : range(thread_count)){
+      threads.emplace_back([this, i]{ work(i); });
+
+      if (pin_threads){
+        pin(threads.back(), i % default_thread_count());
+      }
+    }
+  }
+
+  ThreadPool(const ThreadPool&) = delete;
+  auto operator=(const ThreadPool&) -> ThreadPool& = delete;
+
+  static auto pin(std::thread& thread, u32 core) -> void{
+#ifdef __linux__
+    auto cpus = cpu_set_t();
+    CPU_ZERO(&cpus);
+    CPU_SET(core, &cpus);
+    pthread_setaffinity_np(thread.native_handle(), sizeof(cpus), &cpus);
+#endif
+  }
+
+  auto thread_count() const{
+    return u32(threads.size());
+  }
+
+  auto take(u32 index, task_t& task) -> bool{
+    {
+      auto& own = *queues[index];
+      auto lock = std::lock_guard(own.mtx);
+      if (!own.tasks.empty()){
+        task = std::move(own.tasks.back());
+        own.tasks.pop_back();
+        return true;
+      }
+    }
+
+    for (auto offset : range(1, queues.size())){
+      auto& victim = *queues[(index + offset) % queues.size()];
+      auto lock = std::lock_guard(victim.mtx);
+      if (!victim.tasks.empty()){
+        task = std::move(victim.tasks.front());
+        victim.tasks.pop_front();
+        return true;
+      }
+    }
+
+    return false;
+  }
+
+  auto work(u32 index) -> void{
+    worker_index() = index;
+
+    while(true){
+      auto task = task_t();
+
+      if (take(index, task)){
+        queued--;
+
+        //An escaping exception would terminate the process, it is handed to wait() instead:
+        try{
+          task();
+        }
+        catch(...){
+          auto lock = std::lock_guard(mtx);
+          if (!error){
+            error = std::current_exception();
+          }
+        }
+
+        if (--pending == 0){
+          auto lock = std::lock_guard(mtx);
+          all_done.notify_all();
+        }
+        continue;
+      }
+
+      auto lock = std::unique_lock(mtx);
+      task_available.wait(lock, [&]{ return stopping || queued > 0; });
+
+      if (stopping && queued == 0) return;
+    }
+  }
+
+  auto submit(task_t task){
+    const auto worker = worker_index();
+    const auto index = worker >= 0 && u32(worker) < queues.size() && std::this_thread::get_id() == threads[worker].get_id()
+      ? u32(worker)
+      : next_queue++ % queues.size();
+
+    pending++;
+    {
+      auto& queue = *queues[index];
+      auto lock = std::lock_guard(queue.mtx);
+      queue.tasks.push_back(std::move(task));
+    }
+    {
+      auto lock = std::lock_guard(mtx);
+      queued++;
+    }
+    task_available.notify_one();
+  }
+
+  //Blocks until every submitted task has finished, including tasks submitted by other tasks.
+  //If any of them threw, the first exception is rethrown here once all are done
+  auto wait(){
+    auto lock = std::unique_lock(mtx);
+    all_done.wait(lock, [&]{ return pending == 0; });
+
+    if (error){
+      std::rethrow_exception(std::exchange(error, nullptr));
+    }
+  }
+
+  ~ThreadPool(){
+    {
+      auto lock = std::lock_guard(mtx);
+      stopping = true;
+    }
+    task_available.notify_all();
+
+    for (auto& thread : threads){
+      thread.join();
+    }
+  }
+};
+
+} //namespace nes
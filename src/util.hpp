@@ -2,6 +2,8 @@
 
 #include "aliases.hpp"
 #include <utility>
+#include <cstddef>
+#include <vector>
 #include <string>
 #include <fstream>
 #include <sstream>
@@ -32,7 +34,7 @@ inline auto in_range(i32 value, const range_type<i32>& range){
   return value >= range.first && value <= range.second;
 }
 
-inline auto operator""_kb(unsigned long long v){
+inline constexpr auto operator""_kb(unsigned long long v){
   return v * 1024;
 }
 
@@ -111,6 +113,34 @@ struct Ring{
   }
 };
 
+//Non-owning view of contiguous memory:
+template<typename T>
+struct Span{
+  T* pointer = nullptr;
+  std::size_t length = 0;
+
+  Span() {}
+  Span(T* pointer, std::size_t length) : pointer(pointer), length(length) {}
+
+  template<typename Container>
+  Span(Container& container) : pointer(container.data()), length(container.size()) {}
+
+  auto data() const{ return pointer; }
+  auto size() const{ return length; }
+  auto empty() const{ return length == 0; }
+
+  auto begin() const{ return pointer; }
+  auto end() const{ return pointer + length; }
+
+  auto operator[](std::size_t index) const -> T&{
+    return pointer[index];
+  }
+
+  auto subspan(std::size_t offset, std::size_t count) const{
+    return Span(pointer + offset, count);
+  }
+};
+
 template<typename T, typename Enum>
 struct Register{
   T value = 0;
@@ -145,6 +175,11 @@ struct Request{
   mutable std::mutex mtx;
   mutable std::condition_variable cv;
 
+  Request() {}
+
+  //Nobody waits on a copy yet, so it starts with its own mutex and condition:
+  Request(const Request&) {}
+
   auto send() const{
     auto lock = std::lock_guard(mtx);
     cv.notify_one();
@@ -1,8 +1,20 @@
 #include <iostream>
 #include "../src/nes.hpp"
+#include "../src/batch_runner.hpp"
+#include "../src/environment.hpp"
+#include "../src/lockstep.hpp"
+#include "../src/sweep.hpp"
+#include "../src/library.hpp"
+#include "../src/audio.hpp"
+#ifndef _WIN32
+#include "../src/server.hpp"
+#include <thread>
+#endif
 #include <sstream>
 #include <string>
 #include <vector>
+#include <tuple>
+#include <algorithm>
 
 namespace nes{
 
@@ -87,8 +99,1206 @@ inline auto test_cpu(){
   std::cerr << "0x03: " << int(nes.ram[3]) << '\n';
 }
 
+//Writes a 32Kb PRG, 8Kb CHR image. 'header' holds the iNES bytes after the magic, 'program' is
+//placed at the reset address, and the rest of PRG is zero up to the vectors
+inline auto write_nrom(
+  const std::string& filepath, const std::vector<u8>& header, const std::vector<u8>& program,
+  u16 nmi, u16 reset, u16 irq, u8 char_fill = 0
+){
+  auto rom = std::vector<u8>(16 + 32_kb + 8_kb, 0);
+  const u8 magic[] = { 'N', 'E', 'S', 0x1A };
+  std::copy(std::begin(magic), std::end(magic), rom.begin());
+  std::copy(header.begin(), header.end(), rom.begin() + 4);
+
+  std::copy(program.begin(), program.end(), rom.begin() + 16 + (reset - 0x8000));
+
+  auto vector = 16 + 32_kb - 6;
+  for (const auto address : { nmi, reset, irq }){
+    rom[vector++] = address & 0xFF;
+    rom[vector++] = address >> 8;
+  }
+
+  std::fill(rom.begin() + 16 + 32_kb, rom.end(), char_fill);
+
+  auto file = std::ofstream(filepath, std::ios::binary);
+  file.write(reinterpret_cast<const char*>(rom.data()), rom.size());
+}
+
+//NROM image that starts pulse 1 on a constant 50% duty tone at full volume and spins
+inline auto write_tone_rom(const std::string& filepath){
+  write_nrom(filepath, { 2, 1, 0x00, 0x00 }, {
+    0xA9, 0x01,       //LDA #$01
+    0x8D, 0x15, 0x40, //STA $4015, pulse 1 on
+    0xA9, 0xBF,       //LDA #$BF
+    0x8D, 0x00, 0x40, //STA $4000, 50% duty, halted length, constant volume 15
+    0xA9, 0xFD,       //LDA #$FD
+    0x8D, 0x02, 0x40, //STA $4002, timer low
+    0xA9, 0x00,       //LDA #$00
+    0x8D, 0x03, 0x40, //STA $4003, timer high and length
+    0x4C, 0x14, 0x80  //JMP $8014
+  }, 0x0000, 0x8000, 0x0000);
+}
+
+inline auto test_audio_rendering(){
+  static constexpr auto Seconds = 1;
+  static constexpr auto SampleCount = u32(Nes::AudioSampleRate) * Seconds;
+
+  //Not a multiple of the sink's block, the tail must still come out:
+  static constexpr auto ShortCount = AudioSink::BlockSize * 3 + 100;
+
+  write_tone_rom("tone.nes");
+
+  auto render = [](MemoryAudioSink& sink, u32 sample_count){
+    Nes nes(Nes::DisableVisualMode);
+    nes.load_cardridge("tone.nes");
+    nes.render_audio(sink, sample_count);
+  };
+
+  //Two instances in one process must produce identical, complete streams
+  MemoryAudioSink first, second, short_run;
+  render(first, SampleCount);
+  render(second, SampleCount);
+  render(short_run, ShortCount);
+
+  test("SAMPLES", 0, SampleCount, first.samples.size());
+  test("SAMPLES", 0, SampleCount, second.samples.size());
+  test("SAMPLES", 0, ShortCount, short_run.samples.size());
+
+  if (first.samples != second.samples || !std::equal(short_run.samples.begin(), short_run.samples.end(), first.samples.begin())){
+    throw std::runtime_error("Audio rendering is not deterministic");
+  }
+
+  //A tone, not silence, and the same one as always. Hashed as 16-bit PCM so the last bits of
+  //float rounding don't matter:
+  auto energy = 0.0;
+  auto pcm = std::vector<u8>();
+  for (const auto sample : first.samples){
+    energy += sample * sample;
+
+    const auto value = i16(std::lround(sample * 32767.f));
+    pcm.push_back(value & 0xFF);
+    pcm.push_back(u16(value) >> 8);
+  }
+
+  if (energy / SampleCount < 1e-3){
+    throw std::runtime_error("Rendered tone is silent, mean energy " + std::to_string(energy / SampleCount));
+  }
+
+  const auto hash = crc32(pcm);
+  if (hash != 0x476E8059){
+    throw std::runtime_error("Rendered tone changed, hash " + hex_str(u16(hash >> 16)) + hex_str(u16(hash)));
+  }
+
+  //The same samples streamed to a .wav file, with the sizes patched in when the sink closes:
+  {
+    auto sink = WavAudioSink("tone.wav", Nes::AudioSampleRate);
+    Nes nes(Nes::DisableVisualMode);
+    nes.load_cardridge("tone.nes");
+    nes.render_audio(sink, ShortCount);
+  }
+
+  auto wav = std::vector<u8>();
+  {
+    auto file = std::ifstream("tone.wav", std::ios::binary);
+    wav.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+  }
+  std::filesystem::remove("tone.wav");
+
+  const auto field = [&](u32 offset, u32 size){
+    auto value = u32(0);
+    for (auto i : range(size)){
+      value |= u32(wav[offset + i]) << (i * 8);
+    }
+    return value;
+  };
+
+  const auto expect = [&](const std::string& name, u32 offset, u32 size, u32 expected){
+    if (field(offset, size) != expected){
+      throw std::runtime_error("Expected WAV " + name + " " + std::to_string(expected) + " but got " + std::to_string(field(offset, size)));
+    }
+  };
+
+  const auto data_size = ShortCount * u32(sizeof(float));
+  if (wav.size() != WavAudioSink::HeaderSize + data_size || std::string(wav.begin(), wav.begin() + 4) != "RIFF"
+    || std::string(wav.begin() + 8, wav.begin() + 16) != "WAVEfmt " || std::string(wav.begin() + 36, wav.begin() + 40) != "data"){
+    throw std::runtime_error("WAV file is not a RIFF/WAVE file of " + std::to_string(ShortCount) + " samples");
+  }
+
+  expect("RIFF size", 4, 4, WavAudioSink::HeaderSize - 8 + data_size);
+  expect("format", 20, 2, WavAudioSink::FloatFormat);
+  expect("channels", 22, 2, 1);
+  expect("sample rate", 24, 4, Nes::AudioSampleRate);
+  expect("byte rate", 28, 4, Nes::AudioSampleRate * sizeof(float));
+  expect("bits per sample", 34, 2, 32);
+  expect("data size", 40, 4, data_size);
+
+  for (auto i : range(ShortCount)){
+    auto bits = u32(0);
+    std::memcpy(&bits, &short_run.samples[i], sizeof(bits));
+    expect("sample " + std::to_string(i), WavAudioSink::HeaderSize + i * 4, 4, bits);
+  }
+
+  //The sample clock must hit every output rate exactly, without drift
+  for (auto sample_rate : { 32000, 44100, 48000, 96000 }){
+    auto clock = SampleClock(Nes::CyclesPerSec, sample_rate);
+    auto samples = 0;
+
+    for (auto i : range(Nes::CyclesPerSec)){
+      samples += clock.tick();
+    }
+
+    if (samples != sample_rate){
+      throw std::runtime_error("Sample clock drifted at " + std::to_string(sample_rate) + " Hz");
+    }
+  }
+
+  //No samples, or more than one per CPU cycle, can't be scheduled:
+  Nes nes(Nes::DisableVisualMode);
+  for (auto sample_rate : { u32(0), Nes::CyclesPerSec + 1 }){
+    auto rejected = false;
+    try{
+      nes.set_audio_sample_rate(sample_rate);
+    }
+    catch(const std::runtime_error&){
+      rejected = true;
+    }
+
+    if (!rejected || nes.sample_clock.sample_rate != Nes::AudioSampleRate){
+      throw std::runtime_error("Sample rate " + std::to_string(sample_rate) + " was accepted");
+    }
+  }
+
+  std::cerr << "AUDIO TESTS PASSED!\n";
+}
+
+inline auto test_audio_latency(){
+  //Adaptive buffers double their period after underruns, up to the limit:
+  const auto latency = AudioLatency::low();
+  if (latency.grown_period(128) != 256 || latency.grown_period(3000) != latency.max_period_frames
+    || latency.grown_period(latency.max_period_frames) != latency.max_period_frames || latency.grown_period(0) != 0){
+    throw std::runtime_error("Adaptive audio period doesn't double and clamp");
+  }
+
+  //1000 frames per second and room for 200, so frames and milliseconds are the same numbers:
+  auto monitor = PlaybackMonitor(1000.0, 200);
+  const auto expect = [&](double latency_ms, u32 underruns, const char* when){
+    if (std::abs(monitor.latency_ms - latency_ms) > 1e-6 || monitor.underruns != underruns){
+      throw std::runtime_error(std::string("Playback monitor ") + when + ": " + std::to_string(monitor.latency_ms) + " ms, "
+        + std::to_string(monitor.underruns) + " underruns");
+    }
+  };
+
+  monitor.block_written(0.0, 100);
+  expect(100.0, 0, "after the first block");
+
+  monitor.block_written(0.1, 100);
+  expect(100.0, 0, "on time");
+
+  monitor.block_written(0.15, 100);
+  expect(150.0, 0, "ahead of the device");
+
+  //Everything written was played by 0.3, the device ran dry until this block came:
+  monitor.block_written(0.5, 100);
+  expect(100.0, 1, "after running dry");
+
+  //No more than the device buffer and the new block can be queued:
+  monitor.block_written(0.5, 100);
+  monitor.block_written(0.5, 100);
+  expect(300.0, 1, "with a full buffer");
+
+  monitor.block_written(0.5, 100);
+  expect(300.0, 1, "beyond the device buffer");
+
+  std::cerr << "AUDIO LATENCY TESTS PASSED!\n";
+}
+
+inline auto test_noise_sequences(){
+  //The tables must match the shift register they replace, in both modes
+  for (auto mode : { false, true }){
+    auto noise = NoiseChannel();
+    noise.update_mode(mode ? 0x80 : 0x00);
+
+    u16 sequence = NoiseSequences::Seed;
+    const auto tap = mode ? 6 : 1;
+
+    for (auto i : range(NoiseSequences::LongPeriod * 2)){
+      test("NOISE", i, sequence & 1, noise.bit());
+      test("NOISE AHEAD", i, noise.bit(1000), [&]{
+        auto copy = noise;
+        copy.advance(1000);
+        return copy.bit();
+      }());
+
+      const auto feedback = (sequence & 1) ^ ((sequence >> tap) & 1);
+      sequence = (feedback << 14) | (sequence >> 1);
+      noise.advance(1);
+    }
+  }
+
+  std::cerr << "NOISE TESTS PASSED!\n";
+}
+
+inline auto test_shared_rom(){
+  Nes first(Nes::DisableVisualMode);
+  Nes second(Nes::DisableVisualMode);
+
+  first.load_cardridge("nestest.nes");
+  second.load_cardridge("nestest.nes");
+
+  if (first.cardridge.rom != second.cardridge.rom){
+    throw std::runtime_error("ROM image was loaded twice");
+  }
+
+  if (first.cardridge.program_memory.data() != second.cardridge.program_memory.data()){
+    throw std::runtime_error("PRG-ROM is not shared between instances");
+  }
+
+  std::cerr << "ROM SHARING TESTS PASSED!\n";
+}
+
+//An empty MMC1 cart with battery-backed PRG-RAM
+inline auto write_battery_rom(const std::string& filepath){
+  write_nrom(filepath, { 2, 1, 0x12, 0x00 }, {}, 0x0000, 0x8000, 0x0000);
+}
+
+//Battery RAM is private unless the host asks for the .sav file
+inline auto test_battery_ram(){
+  write_battery_rom("battery.nes");
+  std::filesystem::remove("battery.sav");
+
+  auto first = std::make_unique<Nes>(Nes::DisableVisualMode);
+  auto second = std::make_unique<Nes>(Nes::DisableVisualMode);
+  first->load_cardridge("battery.nes");
+  second->load_cardridge("battery.nes");
+
+  first->mem_write(0x6000, 0x42);
+  second->mem_write(0x6001, 0x24);
+
+  if (second->mem_read(0x6000) != 0 || first->mem_read(0x6001) != 0 || first->mem_read(0x6000) != 0x42){
+    throw std::runtime_error("Instances of one battery ROM share PRG-RAM");
+  }
+
+  first.reset();
+  second.reset();
+  if (std::filesystem::exists("battery.sav")){
+    throw std::runtime_error("Battery RAM was saved without persistence");
+  }
+
+  //The frontend's path still round-trips through the .sav file:
+  for (auto value : { 0x42, 0x00 }){
+    auto nes = std::make_unique<Nes>(Nes::DisableVisualMode);
+    nes->load_cardridge("battery.nes", Nes::PersistSave);
+
+    if (value == 0x00 && nes->mem_read(0x6000) != 0x42){
+      throw std::runtime_error("Battery RAM was not restored from the .sav file");
+    }
+    nes->mem_write(0x6000, value);
+  }
+
+  std::filesystem::remove("battery.sav");
+
+  std::cerr << "BATTERY RAM TESTS PASSED!\n";
+}
+
+//Writes a 32Kb MMC3 ROM that takes an IRQ every 'latch' + 1 counted A12 rises and counts them at
+//$10. 'control' is written to PPUCTRL and picks the pattern tables, sprites at $1000 by default
+inline auto write_mmc3_irq_rom(const std::string& filepath, u8 control = 0x08, u8 latch = 0x07){
+  //Runs from the fixed last bank at $E000:
+  write_nrom(filepath, { 2, 1, 0x40, 0x00 }, {
+    0x78,             //SEI
+    0xA9, control,    //LDA #control
+    0x8D, 0x00, 0x20, //STA $2000
+    0xA9, 0x1E,       //LDA #$1E
+    0x8D, 0x01, 0x20, //STA $2001
+    0xA9, latch,      //LDA #latch
+    0x8D, 0x00, 0xC0, //STA $C000
+    0x8D, 0x01, 0xC0, //STA $C001
+    0x8D, 0x01, 0xE0, //STA $E001
+    0x58,             //CLI
+    0x4C, 0x17, 0xE0, //JMP $E017
+    0xE6, 0x10,       //IRQ: INC $10
+    0xD0, 0x02,       //BNE +2
+    0xE6, 0x11,       //INC $11
+    0x8D, 0x00, 0xE0, //STA $E000
+    0x8D, 0x01, 0xE0, //STA $E001
+    0x40              //RTI
+  }, 0xE026, 0xE000, 0xE01A);
+}
+
+inline auto test_mmc3_irq(){
+  //PPUCTRL, IRQ latch and the counted A12 rises per frame. Sprites at $1000 rise at dot 261 of every
+  //rendered line, background at $1000 at dot 325 and at dot 5 of the pre-render line, with both
+  //tables at $0000 A12 never rises. An IRQ every 7 rises moves through every edge of the frame,
+  //the one at dot 5 included
+  const std::tuple<u8, u8, i32> Layouts[] = {
+    { 0x08, 0x07, Ppu::ScreenSize.y + 1 },
+    { 0x10, 0x06, Ppu::ScreenSize.y + 2 },
+    { 0x00, 0x07, 0 }
+  };
+
+  for (const auto& [control, latch, edges_per_frame] : Layouts){
+    write_mmc3_irq_rom("mmc3_irq.nes", control, latch);
+
+    //'predicted' only looks at the IRQ line at predicted dots, 'polled' looks at it every dot
+    Nes predicted(Nes::DisableVisualMode);
+    Nes polled(Nes::DisableVisualMode);
+
+    for (auto nes : { &predicted, &polled }){
+      nes->ram.fill(0);
+      nes->load_cardridge("mmc3_irq.nes");
+    }
+
+    const auto frames = 8;
+    const auto frame_dots = (Ppu::MaxScanlines + 2) * (Ppu::CyclesPerScanline + 1);
+    const auto layout = "PPUCTRL $" + std::to_string(control >> 4) + "0";
+
+    for (auto i : range(frames * frame_dots)){
+      predicted.clock();
+
+      polled.irq_dot = 0;
+      polled.clock();
+
+      if (predicted.cpu.pc != polled.cpu.pc || predicted.ram[0x10] != polled.ram[0x10]){
+        throw std::runtime_error("Predicted MMC3 IRQ diverged at dot " + std::to_string(i) + " with " + layout);
+      }
+    }
+
+    const auto irqs = predicted.ram[0x10] | (predicted.ram[0x11] << 8);
+    const auto expected = frames * edges_per_frame / (latch + 1);
+    if (std::abs(irqs - expected) > 1){
+      throw std::runtime_error("Expected about " + std::to_string(expected) + " MMC3 IRQs with " + layout + " but got " + std::to_string(irqs));
+    }
+  }
+
+  std::cerr << "MMC3 IRQ TESTS PASSED!\n";
+}
+
+inline auto test_compressed_rom(){
+  //Fixed Huffman and stored blocks, the gzip and zip fixtures use dynamic blocks:
+  const u8 fixed[] = { 0xCB, 0x4B, 0x2D, 0x56, 0xC8, 0x43, 0xC2, 0xA9, 0xB9, 0xA5, 0x39, 0x89, 0x25, 0xF9, 0x45, 0x00 };
+  const u8 stored[] = { 0x01, 0x06, 0x00, 0xF9, 0xFF, 0x73, 0x74, 0x6F, 0x72, 0x65, 0x64 };
+
+  for (const auto& [input, size, expected] : { 
+    std::make_tuple(fixed, sizeof(fixed), std::string("nes nes nes nes emulator")),
+    std::make_tuple(stored, sizeof(stored), std::string("stored"))
+  }){
+    auto output = std::vector<u8>();
+    Inflate::decode(Span<const u8>(input, size), output);
+
+    if (std::string(output.begin(), output.end()) != expected){
+      throw std::runtime_error("Inflated '" + expected + "' incorrectly");
+    }
+  }
+
+  //A stream that inflates past its limit fails there, without allocating the rest:
+  auto limited = std::vector<u8>();
+  auto over_limit = false;
+  try{
+    Inflate::decode(Span<const u8>(fixed, sizeof(fixed)), limited, 10);
+  }
+  catch(const std::runtime_error&){
+    over_limit = limited.size() <= 10;
+  }
+
+  if (!over_limit){
+    throw std::runtime_error("Inflate ignored its output limit");
+  }
+
+  //Sizes in the gzip trailer that are too small, or far beyond any ROM, are rejected:
+  auto gzip = std::vector<u8>();
+  {
+    auto file = std::ifstream("nestest.nes.gz", std::ios::binary);
+    gzip.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+  }
+
+  for (const auto declared_size : { u32(100), u32(0xFFFFFF00) }){
+    for (auto i : range(4)){
+      gzip[gzip.size() - 4 + i] = declared_size >> (i * 8);
+    }
+
+    auto file = std::ofstream("corrupt.nes.gz", std::ios::binary);
+    file.write(reinterpret_cast<const char*>(gzip.data()), gzip.size());
+    file.close();
+
+    auto rejected = false;
+    try{
+      RomImage("corrupt.nes.gz");
+    }
+    catch(const std::runtime_error&){
+      rejected = true;
+    }
+
+    if (!rejected){
+      throw std::runtime_error("Gzip declaring " + std::to_string(declared_size) + " bytes was accepted");
+    }
+  }
+  std::filesystem::remove("corrupt.nes.gz");
+
+  const auto raw = RomImage("nestest.nes");
+
+  for (const auto& filepath : { "nestest.nes.gz", "nestest.zip" }){
+    const auto rom = RomImage(filepath);
+
+    const auto same_program = std::equal(rom.program_rom.begin(), rom.program_rom.end(), raw.program_rom.begin(), raw.program_rom.end());
+    const auto same_char = std::equal(rom.char_rom.begin(), rom.char_rom.end(), raw.char_rom.begin(), raw.char_rom.end());
+
+    if (!same_program || !same_char || rom.game_name != "nestest"){
+      throw std::runtime_error(std::string("ROM loaded from ") + filepath + " differs from the raw file");
+    }
+  }
+
+  std::cerr << "COMPRESSED ROM TESTS PASSED!\n";
+}
+
+//Uneven episodes spread over a work-stealing pool must end exactly like serial runs
+inline auto test_batch_runner(){
+  const auto episode_frames = std::vector<u32>{ 7, 2, 5, 1, 9, 3 };
+  auto hashes = std::vector<u32>(episode_frames.size(), 0);
+
+  auto pool = ThreadPool(3);
+  auto runner = BatchRunner(RomImage::load("nestest.nes"), 2, pool);
+  runner.quantum = 2;
+
+  const auto stats = runner.run(episode_frames, {}, [&](u32 episode, Nes& nes){
+    hashes[episode] = nes.frame_hash();
+  });
+
+  if (stats.frames != 27){
+    throw std::runtime_error("Batch ran " + std::to_string(stats.frames) + " frames instead of 27");
+  }
+
+  for (auto episode : range(episode_frames.size())){
+    auto nes = std::make_unique<Nes>();
+    nes->load_cardridge("nestest.nes");
+
+    for (auto frame : range(episode_frames[episode])){
+      nes->run_frame();
+    }
+
+    if (nes->frame_hash() != hashes[episode]){
+      throw std::runtime_error("Batch episode " + std::to_string(episode) + " diverged from a serial run");
+    }
+  }
+
+  //Every episode of a battery cart starts from empty PRG-RAM, whatever the others wrote:
+  write_battery_rom("battery.nes");
+  auto battery_runner = BatchRunner(RomImage::load("battery.nes"), 2, pool);
+  auto dirty_starts = std::atomic<u32>(0);
+
+  battery_runner.run(episode_frames, [&](u32 episode, u32 frame, Nes& nes){
+    if (frame == 0 && nes.mem_read(0x6000) != 0) dirty_starts++;
+    nes.mem_write(0x6000, episode + 1);
+  });
+
+  if (dirty_starts > 0 || std::filesystem::exists("battery.sav")){
+    throw std::runtime_error("Batch episodes share battery RAM");
+  }
+
+  std::cerr << "BATCH RUNNER TESTS PASSED!\n";
+}
+
+//A throwing task must reach wait() instead of terminating the process
+inline auto test_thread_pool_errors(){
+  auto pool = ThreadPool(3);
+  auto finished = std::atomic<u32>(0);
+
+  for (auto i : range(100)){
+    pool.submit([&, i]{
+      if (i == 17) throw std::runtime_error("task 17 failed");
+      if (i == 60) throw 60;
+      finished++;
+    });
+  }
+
+  auto message = std::string();
+  try{
+    pool.wait();
+  }
+  catch(const std::runtime_error& error){
+    message = error.what();
+  }
+  catch(int){
+    message = "60";
+  }
+
+  if ((message != "task 17 failed" && message != "60") || finished != 98){
+    throw std::runtime_error("Pool reported '" + message + "' after " + std::to_string(finished) + " tasks");
+  }
+
+  //The error is reported once, the pool keeps working:
+  pool.submit([&]{ finished++; });
+  pool.wait();
+
+  if (finished != 99){
+    throw std::runtime_error("Pool stopped working after a task threw");
+  }
+
+  std::cerr << "THREAD POOL TESTS PASSED!\n";
+}
+
+inline auto test_environment(){
+  auto environment = Environment("nestest.nes");
+
+  const auto ram = environment.step(Environment::Start, 3);
+  if (ram.data() != environment.nes->ram.data() || ram.size() != Nes::CpuMemSize){
+    throw std::runtime_error("RAM observation is not a view of Nes::ram");
+  }
+
+  //Controller 2 shifts out through $4017 after the strobe:
+  auto& nes = *environment.nes;
+  nes.controllers[1] = 0xA5;
+  nes.mem_write(Nes::Controller1Address, 1);
+  nes.mem_write(Nes::Controller1Address, 0);
+
+  auto buttons = u8(0);
+  for (auto i : range(8)){
+    buttons = (buttons << 1) | nes.mem_read(Nes::Controller2Address);
+  }
+
+  if (buttons != 0xA5){
+    throw std::runtime_error("Controller 2 read " + hex_str(buttons) + " instead of $A5");
+  }
+
+  //Downsampling against a straightforward per-pixel reference:
+  auto& framebuffer = nes.finished_framebuffer;
+  for (auto i : range(framebuffer.pixels.size())){
+    framebuffer.pixels[i] = Framebuffer::pixel_color(i * 7, i * 13 + (i >> 8), i >> 5);
+  }
+
+  for (auto factor : { 1, 2, 3, 4 }){
+    const auto width = 256 / factor;
+    const auto height = 240 / factor;
+
+    auto output = std::vector<u8>(width * height);
+    environment.downsample(factor, output);
+
+    for (auto [x, y] : range({ width, height })){
+      auto red = 0u, green = 0u, blue = 0u;
+      for (auto [dx, dy] : range({ factor, factor })){
+        const auto& pixel = framebuffer.pixels[(y * factor + dy) * 256 + x * factor + dx];
+        red += pixel.x;
+        green += pixel.y;
+        blue += pixel.z;
+      }
+
+      const auto expected = (77 * red + 150 * green + 29 * blue) / (256 * factor * factor);
+      if (output[y * width + x] != expected){
+        throw std::runtime_error("Downsample by " + std::to_string(factor) + " differs at " + std::to_string(x) + ", " + std::to_string(y));
+      }
+    }
+  }
+
+  std::cerr << "ENVIRONMENT TESTS PASSED!\n";
+}
+
+//Lockstep lanes must match scalar instances frame by frame, also when their inputs diverge
+inline auto test_lockstep(){
+  constexpr auto Lanes = 8;
+
+  const auto compare = [](const auto& lockstep, u32 lane, const Nes& nes, const std::string& context){
+    const auto& cpu = lockstep.cpu;
+    const auto same_registers = cpu.pc[lane] == nes.cpu.pc && cpu.a[lane] == nes.cpu.accumulator
+      && cpu.x[lane] == nes.cpu.x && cpu.y[lane] == nes.cpu.y && cpu.sp[lane] == nes.cpu.sp
+      && cpu.p[lane] == nes.cpu.status.value && cpu.req_cycles[lane] == nes.cpu.req_cycles;
+
+    if (!same_registers || lockstep.frame_hash(lane) != nes.frame_hash()){
+      throw std::runtime_error("Lockstep lane " + std::to_string(lane) + " diverged " + context);
+    }
+  };
+
+  //nestest's automated mode runs every official and unofficial opcode:
+  {
+    auto lockstep = std::make_unique<Lockstep<Lanes>>();
+    lockstep->load_cardridge("nestest.nes");
+
+    auto nes = std::make_unique<Nes>();
+    nes->load_cardridge("nestest.nes");
+    nes->cpu.pc = 0xC000;
+
+    for (auto lane : range(Lanes)){
+      lockstep->cpu.pc[lane] = 0xC000;
+    }
+
+    for (auto dot : range(26000 * 3)){
+      lockstep->clock();
+      nes->clock();
+    }
+
+    for (auto lane : range(Lanes)){
+      compare(*lockstep, lane, *nes, "in nestest's automated mode");
+    }
+  }
+
+  //Every lane presses something else in the menu, so lanes split and execute different paths:
+  {
+    const u8 buttons[Lanes] = { 0x00, 0x10, 0x04, 0x20, 0x08, 0x80, 0x14, 0x40 };
+
+    auto lockstep = std::make_unique<Lockstep<Lanes>>();
+    lockstep->load_cardridge("nestest.nes");
+
+    auto scalar = std::vector<std::unique_ptr<Nes>>();
+    for (auto lane : range(Lanes)){
+      scalar.push_back(std::make_unique<Nes>());
+      scalar.back()->load_cardridge("nestest.nes");
+    }
+
+    for (auto frame : range(16)){
+      for (auto lane : range(Lanes)){
+        const auto pressed = frame >= 3 + lane % 3 && frame < 5 + lane % 3 ? buttons[lane] : 0;
+        lockstep->lanes[lane]->controllers[0] = pressed;
+        scalar[lane]->controllers[0] = pressed;
+      }
+
+      lockstep->run_frame();
+      for (auto lane : range(Lanes)){
+        scalar[lane]->run_frame();
+        compare(*lockstep, lane, *scalar[lane], "on frame " + std::to_string(frame));
+      }
+    }
+  }
+
+  //MMC3 scanline IRQs go through each lane's own mapper:
+  {
+    write_mmc3_irq_rom("mmc3_irq.nes");
+
+    auto lockstep = std::make_unique<Lockstep<4>>();
+    lockstep->load_cardridge("mmc3_irq.nes");
+
+    auto nes = std::make_unique<Nes>();
+    nes->load_cardridge("mmc3_irq.nes");
+
+    for (auto frame : range(4)){
+      lockstep->run_frame();
+      nes->run_frame();
+
+      for (auto lane : range(4)){
+        compare(*lockstep, lane, *nes, "with MMC3 IRQs on frame " + std::to_string(frame));
+      }
+    }
+  }
+
+  std::cerr << "LOCKSTEP TESTS PASSED!\n";
+}
+
+//A clone must be independent of its source and then run exactly like it
+inline auto test_clone(){
+  auto nes = std::make_unique<Nes>();
+  nes->load_cardridge("nestest.nes");
+  nes->controllers[0] = Environment::Start;
+
+  for (auto frame : range(5)){
+    nes->run_frame();
+  }
+
+  auto copy = nes->clone();
+  if (copy->cardridge.rom != nes->cardridge.rom || copy->frame_hash() != nes->frame_hash()){
+    throw std::runtime_error("Clone does not start in the state of its source");
+  }
+
+  for (auto frame : range(10)){
+    nes->run_frame();
+    copy->run_frame();
+
+    if (copy->frame_hash() != nes->frame_hash()){
+      throw std::runtime_error("Clone diverged on frame " + std::to_string(frame));
+    }
+  }
+
+  copy->mem_write(0x0300, ~nes->mem_read(0x0300));
+  if (copy->mem_read(0x0300) == nes->mem_read(0x0300)){
+    throw std::runtime_error("Clone shares RAM with its source");
+  }
+
+  //Mapper registers, PRG-RAM and CHR-RAM are the clone's own:
+  write_mmc3_irq_rom("mmc3_irq.nes");
+  auto image = std::vector<u8>(RomImage("mmc3_irq.nes").program_rom.size() + 16);
+  {
+    auto file = std::ifstream("mmc3_irq.nes", std::ios::binary);
+    file.read(reinterpret_cast<char*>(image.data()), image.size());
+    image[5] = 0;
+
+    auto output = std::ofstream("mmc3_chr_ram.nes", std::ios::binary);
+    output.write(reinterpret_cast<const char*>(image.data()), image.size());
+  }
+
+  nes = std::make_unique<Nes>();
+  nes->load_cardridge("mmc3_chr_ram.nes");
+  nes->mem_write(0x6000, 0x11);
+  nes->run_frame();
+
+  copy = nes->clone();
+  copy->mem_write(0x6000, 0x22);
+
+  const auto& cardridge = copy->cardridge;
+  const auto char_page = cardridge.banks->char_pages[0];
+  const auto in_char_ram = char_page >= cardridge.char_ram.data() && char_page < cardridge.char_ram.data() + cardridge.char_ram.size();
+
+  if (nes->mem_read(0x6000) != 0x11 || cardridge.banks != &std::get<Mapper004>(cardridge.mapper)
+    || cardridge.char_memory.data() != cardridge.char_ram.data() || !in_char_ram){
+    throw std::runtime_error("Clone still points into its source's cartridge");
+  }
+
+  for (auto frame : range(3)){
+    nes->run_frame();
+    copy->run_frame();
+  }
+
+  if (copy->frame_hash() != nes->frame_hash() || copy->mem_read(0x10) != nes->mem_read(0x10)){
+    throw std::runtime_error("Clone diverged with MMC3 IRQs");
+  }
+
+  std::cerr << "CLONE TESTS PASSED!\n";
+}
+
+#ifndef _WIN32
+//Drives sessions through a real socket on localhost and checks the shared-memory frames
+inline auto test_server(){
+  const auto socket_path = std::string("nes_test.sock");
+
+  auto server = Server(socket_path, 2);
+  auto server_thread = std::thread([&]{ server.run(); });
+
+  {
+    auto client = ServerClient(socket_path);
+    auto other = ServerClient(socket_path);
+
+    client.load_rom("nestest.nes");
+    other.load_rom("nestest.nes");
+
+    if (client.ring.name == other.ring.name){
+      throw std::runtime_error("Sessions share a frame ring");
+    }
+
+    auto nes = std::make_unique<Nes>();
+    nes->load_cardridge("nestest.nes");
+    nes->controllers[0] = Environment::Start;
+
+    client.set_input(Environment::Start);
+    if (client.step(5) != 5 || other.step(2) != 2){
+      throw std::runtime_error("Step did not publish one slot per frame");
+    }
+
+    for (auto frame : range(5)){
+      nes->run_frame();
+    }
+
+    const auto& slot = client.ring.latest();
+    const auto pixels = nes->finished_framebuffer.bytes();
+
+    if (slot.frame != 5 || slot.hash != nes->frame_hash() || slot.audio_count == 0
+      || std::memcmp(slot.pixels, pixels.data(), pixels.size()) != 0 || std::memcmp(slot.ram, nes->ram.data(), Nes::CpuMemSize) != 0){
+      throw std::runtime_error("Shared-memory frame differs from a local run");
+    }
+
+    //States are kept by the server, loading one replays the same frames:
+    client.save_state(1);
+    client.step(3);
+    const auto hash = client.ring.latest().hash;
+
+    client.load_state(1);
+    client.step(3);
+
+    if (client.ring.latest().hash != hash || client.ring.latest().frame != 8){
+      throw std::runtime_error("Loaded state did not replay the saved frames");
+    }
+
+    auto failed = false;
+    try{
+      client.load_state(7);
+    }
+    catch(const std::runtime_error&){
+      failed = true;
+    }
+
+    if (!failed){
+      throw std::runtime_error("Loading an empty state slot did not fail");
+    }
+
+    //Sessions of a battery cart never write a save file:
+    write_battery_rom("battery.nes");
+    std::filesystem::remove("battery.sav");
+
+    client.load_rom("battery.nes");
+    other.load_rom("battery.nes");
+    client.step(2);
+    other.step(2);
+
+    if (std::filesystem::exists("battery.sav")){
+      throw std::runtime_error("Server session wrote battery RAM to the .sav file");
+    }
+  }
+
+  //A session whose frame ring can't be created is refused, the server keeps serving the next one:
+  {
+    const auto stale_name = "/nes_" + std::to_string(::getpid()) + "_2";
+    const auto stale_fd = ::shm_open(stale_name.c_str(), O_CREAT | O_RDWR, 0600);
+
+    auto refused = false;
+    try{
+      auto stale = ServerClient(socket_path);
+      stale.load_rom("nestest.nes");
+    }
+    catch(const std::runtime_error&){
+      refused = true;
+    }
+
+    ::close(stale_fd);
+    ::shm_unlink(stale_name.c_str());
+
+    auto client = ServerClient(socket_path);
+    client.load_rom("nestest.nes");
+
+    if (!refused || client.step(1) != 1){
+      throw std::runtime_error("Server did not survive a session without a frame ring");
+    }
+  }
+
+  server.stop();
+  server_thread.join();
+
+  std::cerr << "SERVER TESTS PASSED!\n";
+}
+#endif
+
+//NROM image with opaque tiles everywhere. Sprite 0 sits over the background at (60, 50) and the
+//program counts its hits at $10 and its polling iterations at $11, which records the hit's timing
+inline auto write_sprite0_rom(const std::string& filepath){
+  write_nrom(filepath, { 2, 1, 0x00, 0x00 }, {
+    0x78,             //SEI
+    0xA9, 0x00,       //LDA #$00
+    0x8D, 0x03, 0x20, //STA $2003
+    0xA9, 0x32,       //LDA #$32, y
+    0x8D, 0x04, 0x20, //STA $2004
+    0xA9, 0x00,       //LDA #$00, tile and attributes
+    0x8D, 0x04, 0x20, //STA $2004
+    0x8D, 0x04, 0x20, //STA $2004
+    0xA9, 0x3C,       //LDA #$3C, x
+    0x8D, 0x04, 0x20, //STA $2004
+    0xA9, 0x1E,       //LDA #$1E
+    0x8D, 0x01, 0x20, //STA $2001
+    0xE6, 0x11,       //INC $11
+    0x2C, 0x02, 0x20, //BIT $2002
+    0x50, 0xF9,       //BVC -7
+    0xE6, 0x10,       //INC $10
+    0x2C, 0x02, 0x20, //BIT $2002
+    0x70, 0xFB,       //BVS -5
+    0x4C, 0x1D, 0x80  //JMP $801D
+  }, 0x0000, 0x8000, 0x0000, 0xFF);
+}
+
+//Skipped and timing-only frames must not change anything a game can observe
+inline auto test_render_modes(){
+  using Mode = Ppu::RenderMode;
+
+  write_sprite0_rom("sprite0.nes");
+  write_mmc3_irq_rom("mmc3_irq.nes");
+
+  for (const auto& filepath : { "sprite0.nes", "mmc3_irq.nes", "nestest.nes" }){
+    auto full = std::make_unique<Nes>();
+    auto skip = std::make_unique<Nes>();
+    auto timing = std::make_unique<Nes>();
+
+    for (auto nes : { full.get(), skip.get(), timing.get() }){
+      nes->load_cardridge(filepath);
+      nes->controllers[0] = Environment::Start;
+    }
+
+    skip->ppu.set_render_mode(Mode::Skip, 3);
+    timing->ppu.set_render_mode(Mode::TimingOnly);
+
+    for (auto frame : range(12)){
+      for (auto nes : { full.get(), skip.get(), timing.get() }){
+        nes->run_frame();
+
+        const auto same = nes->ram == full->ram && nes->cpu.pc == full->cpu.pc && nes->cpu.status.value == full->cpu.status.value
+          && nes->ppu.status.value == full->ppu.status.value && nes->cycles == full->cycles;
+
+        if (!same){
+          throw std::runtime_error(std::string(filepath) + " diverged in a render mode on frame " + std::to_string(frame));
+        }
+      }
+
+      if (frame % 3 == 0 && skip->finished_framebuffer.pixels != full->finished_framebuffer.pixels){
+        throw std::runtime_error("Skip mode frame " + std::to_string(frame) + " differs from full rendering");
+      }
+    }
+
+    const auto& pixels = timing->finished_framebuffer.pixels;
+    if (std::any_of(pixels.begin(), pixels.end(), [](const auto& pixel){ return pixel.x != 0 || pixel.y != 0 || pixel.z != 0; })){
+      throw std::runtime_error("Timing-only mode produced pixels");
+    }
+  }
+
+  //The sprite 0 ROM must have hit once per frame for the check above to mean anything:
+  auto nes = std::make_unique<Nes>();
+  nes->load_cardridge("sprite0.nes");
+  nes->ppu.set_render_mode(Mode::TimingOnly);
+
+  for (auto frame : range(5)){
+    nes->run_frame();
+  }
+
+  if (nes->ram[0x10] < 4){
+    throw std::runtime_error("Sprite 0 hit only " + std::to_string(nes->ram[0x10]) + " times in timing-only mode");
+  }
+
+  std::cerr << "RENDER MODE TESTS PASSED!\n";
+}
+
+//A working ROM, one with an unknown mapper, one that jams on its first instruction and a battery cart
+inline auto test_sweep(){
+  using Status = SweepResult::Status;
+
+  const auto directory = std::filesystem::path("sweep_roms");
+  std::filesystem::create_directories(directory);
+  std::filesystem::copy_file("nestest.nes", directory / "nestest.nes", std::filesystem::copy_options::overwrite_existing);
+
+  const auto write_rom = [&](const std::string& filename, u8 flags, u8 first_opcode){
+    auto rom = std::vector<u8>(16 + 32_kb + 8_kb, 0);
+    const u8 header[] = { 'N', 'E', 'S', 0x1A, 2, 1, flags, 0x00 };
+    std::copy(std::begin(header), std::end(header), rom.begin());
+
+    rom[16] = first_opcode;
+    rom[16 + 32_kb - 4] = 0x00;
+    rom[16 + 32_kb - 3] = 0x80;
+
+    auto file = std::ofstream((directory / filename).string(), std::ios::binary);
+    file.write(reinterpret_cast<const char*>(rom.data()), rom.size());
+  };
+
+  write_rom("mapper5.nes", 0x50, 0xEA);
+  write_rom("jam.nes", 0x00, 0x02);
+  write_rom("battery.nes", 0x12, 0xEA);
+
+  auto pool = ThreadPool(2);
+  const auto results = sweep_directory(directory.string(), 10, pool);
+
+  const auto find = [&](const std::string& filename) -> const SweepResult&{
+    return *std::find_if(results.begin(), results.end(), [&](const auto& result){
+      return std::filesystem::path(result.path).filename() == filename;
+    });
+  };
+
+  if (results.size() != 4){
+    throw std::runtime_error("Sweep found " + std::to_string(results.size()) + " ROMs instead of 4");
+  }
+
+  //Sweeps must never leave saves behind in the library:
+  if (find("battery.nes").mapper != 1 || std::filesystem::exists(directory / "battery.sav")){
+    throw std::runtime_error("Sweep wrote battery RAM to the library");
+  }
+
+  const auto& jam = find("jam.nes");
+  if (jam.status != Status::UnsupportedOpcode || !jam.failed_in_cpu || jam.failing_pc != 0x8000 || jam.frames != 0){
+    throw std::runtime_error("Sweep classified the jammed ROM as " + std::string(SweepResult::status_name(jam.status)) + " at " + hex_str(jam.failing_pc));
+  }
+
+  const auto& mapper5 = find("mapper5.nes");
+  if (mapper5.status != Status::UnsupportedMapper || mapper5.failed_in_cpu || mapper5.mapper != 5){
+    throw std::runtime_error("Sweep classified the mapper 5 ROM as " + std::string(SweepResult::status_name(mapper5.status)));
+  }
+
+  //The sweep must see exactly what a standalone run sees:
+  auto nes = std::make_unique<Nes>();
+  nes->load_cardridge("nestest.nes");
+  for (auto frame : range(10)){
+    nes->run_frame();
+  }
+
+  const auto& nestest = find("nestest.nes");
+  if (nestest.status != Status::Ok || nestest.frames != 10 || nestest.mapper != 0 || nestest.hash != nes->frame_hash()){
+    throw std::runtime_error("Sweep result for nestest differs from a standalone run: " + nestest.message);
+  }
+
+  std::filesystem::remove_all(directory);
+
+  std::cerr << "SWEEP TESTS PASSED!\n";
+}
+
+inline auto test_library(){
+  const auto directory = std::filesystem::path("library_roms");
+  std::filesystem::remove_all(directory);
+  std::filesystem::create_directories(directory / "nested");
+  std::filesystem::copy_file("nestest.nes", directory / "nestest.nes");
+  std::filesystem::copy_file("nestest.nes", directory / "nested" / "copy.nes");
+
+  //Parses as an image of one PRG bank, but has no "NES\x1A" magic:
+  const auto write_headerless = [&](u32 size){
+    auto bytes = std::vector<u8>(size, 0);
+    bytes[4] = 1;
+
+    auto file = std::ofstream((directory / "headerless.nes").string(), std::ios::binary);
+    file.write(reinterpret_cast<const char*>(bytes.data()), bytes.size());
+  };
+  write_headerless(16 + 16_kb);
+
+  auto pool = ThreadPool(2);
+  auto library = Library();
+  library.scan(directory.string(), pool);
+
+  if (library.items.size() != 3 || library.hashed != 3 || library.reused != 0){
+    throw std::runtime_error("Library scan found " + std::to_string(library.items.size()) + " ROMs instead of 3");
+  }
+
+  for (const auto& [path, entry] : library.items){
+    const auto valid = std::filesystem::path(path).filename() != "headerless.nes";
+    if (entry.has(LibraryEntry::Valid) != valid || (valid && (!entry.has(LibraryEntry::Supported) || entry.mapper != 0))){
+      throw std::runtime_error("Library misclassified " + path);
+    }
+  }
+
+  //Everything survives a save and load:
+  const auto index_path = (directory / "library.idx").string();
+  library.save(index_path);
+
+  auto loaded = Library();
+  if (!loaded.load(index_path) || loaded.items.size() != library.items.size()){
+    throw std::runtime_error("Library index didn't load back");
+  }
+
+  for (auto i : range(library.items.size())){
+    //Only the string table offsets are allowed to differ:
+    auto a = library.items[i];
+    auto b = loaded.items[i];
+    a.entry.path_offset = b.entry.path_offset;
+    a.entry.path_length = b.entry.path_length;
+
+    if (a.path != b.path || std::memcmp(&a.entry, &b.entry, sizeof(LibraryEntry)) != 0){
+      throw std::runtime_error("Library entry changed in the index: " + a.path);
+    }
+  }
+
+  //Unchanged files are reused by size and mtime, only the rewritten one is hashed again:
+  loaded.scan(directory.string(), pool);
+  if (loaded.hashed != 0 || loaded.reused != 3){
+    throw std::runtime_error("Library rescan hashed " + std::to_string(loaded.hashed) + " unchanged files");
+  }
+
+  write_headerless(16 + 32_kb);
+  loaded.scan(directory.string(), pool);
+  if (loaded.hashed != 1 || loaded.reused != 2){
+    throw std::runtime_error("Library rescan missed a changed file");
+  }
+
+  std::filesystem::remove_all(directory);
+
+  std::cerr << "LIBRARY TESTS PASSED!\n";
+}
+
+inline auto test_bank_trace(){
+  auto mapper = BasicMapper<BankTrace>();
+  auto& trace = mapper.trace;
+
+  //Three switches in frame 0, none in frame 1, one in frame 2:
+  trace.set_time(10);
+  for (auto data : { 1, 2, 3 }){
+    mapper.trace_bank_write(0, 0x8000, data);
+  }
+  trace.set_time(2 * BankTrace::DotsPerFrame + 5);
+  mapper.trace_bank_write(5, 0xA001, 7);
+
+  if (trace.register_writes[0] != 3 || trace.register_writes[5] != 1 || trace.frame_writes != std::vector<u32>{ 3, 0, 1 }){
+    throw std::runtime_error("Bank trace miscounted register or frame writes");
+  }
+
+  const auto json = [](BankTrace& trace, const std::string& game_name){
+    auto out = std::ostringstream();
+    trace.write_json(out, game_name, 1);
+    return out.str();
+  };
+
+  const auto summary = json(trace, "Game \"One\"");
+  for (const auto expected : {
+    "\"game\": \"Game \\\"One\\\"\"",
+    "\"mapper\": 1,",
+    "\"frames\": 3,",
+    "\"bank_writes\": 4,",
+    "\"frames_with_writes\": 2,",
+    "\"register_writes\": [3, 0, 0, 0, 0, 1, 0, 0]",
+    "\"frame_writes\": [3, 0, 1]",
+    "{ \"dot\": 10, \"frame\": 0, \"address\": 32768, \"data\": 1, \"register\": 0 }"
+  }){
+    if (summary.find(expected) == std::string::npos){
+      throw std::runtime_error("Bank trace JSON lacks " + std::string(expected) + ":\n" + summary);
+    }
+  }
+
+  //Past 4096 events the ring keeps the newest ones, listed oldest first:
+  auto wrapped = BankTrace();
+  for (auto i : range(BankTrace::EventCapacity + 10)){
+    wrapped.set_time(i);
+    wrapped.bank_write(i % 8, 0x8000, i & 0xFF);
+  }
+
+  const auto recent = json(wrapped, "wrapped");
+  auto listed = 0;
+  for (auto position = recent.find("{ \"dot\""); position != std::string::npos; position = recent.find("{ \"dot\"", position + 1)){
+    listed++;
+  }
+
+  const auto oldest = recent.find("{ \"dot\": 10,");
+  const auto newest = recent.find("{ \"dot\": " + std::to_string(BankTrace::EventCapacity + 9) + ",");
+  if (listed != BankTrace::EventCapacity || recent.find("{ \"dot\": 9,") != std::string::npos
+    || oldest == std::string::npos || newest == std::string::npos || oldest > newest){
+    throw std::runtime_error("Bank trace ring kept the wrong " + std::to_string(listed) + " events");
+  }
+
+  std::cerr << "BANK TRACE TESTS PASSED!\n";
+}
+
+inline auto test_page_classification(){
+  Nes nes(Nes::DisableVisualMode);
+  nes.load_cardridge("nestest.nes");
+
+  //Mapper000: PRG-ROM is write-protected and there is no PRG-RAM
+  const auto original = nes.mem_read(0xC000);
+  nes.mem_write(0xC000, ~original);
+
+  if (nes.mem_read(0xC000) != original || nes.cardridge.program_memory[0] != original){
+    throw std::runtime_error("Write to PRG-ROM was not dropped");
+  }
+
+  if (nes.cardridge.cpu_read(0x6000) != std::nullopt){
+    throw std::runtime_error("Mapper000 $6000 should be open bus");
+  }
+
+  //Mapper004: RAM at $6000, registers behind the ROM at $8000
+  write_mmc3_irq_rom("mmc3_irq.nes");
+  nes.load_cardridge("mmc3_irq.nes");
+
+  nes.mem_write(0x6123, 0x5A);
+  const auto rom_byte = nes.mem_read(0xE000);
+  nes.mem_write(0xE000, ~rom_byte);
+
+  if (nes.mem_read(0x6123) != 0x5A || nes.mem_read(0xE000) != rom_byte){
+    throw std::runtime_error("Mapper004 page classification is wrong");
+  }
+
+  std::cerr << "PAGE CLASSIFICATION TESTS PASSED!\n";
+}
+
 } //namespace nes
 
 auto main() -> int{
   nes::test_cpu();
+  nes::test_audio_rendering();
+  nes::test_audio_latency();
+  nes::test_noise_sequences();
+  nes::test_shared_rom();
+  nes::test_battery_ram();
+  nes::test_mmc3_irq();
+  nes::test_compressed_rom();
+  nes::test_library();
+  nes::test_page_classification();
+  nes::test_bank_trace();
+  nes::test_batch_runner();
+  nes::test_thread_pool_errors();
+  nes::test_environment();
+  nes::test_lockstep();
+  nes::test_clone();
+  nes::test_render_modes();
+  nes::test_sweep();
+#ifndef _WIN32
+  nes::test_server();
+#endif
 }
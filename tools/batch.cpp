@@ -0,0 +1,79 @@
+#include "batch_runner.hpp"
+
+#include <iostream>
+#include <iomanip>
+
+//Uneven but reproducible episode lengths, between half and one and a half times 'frames':
+static auto episode_lengths(nes::u32 episodes, nes::u32 frames){
+  auto lengths = std::vector<nes::u32>();
+  auto state = nes::u32(0x2545F491);
+
+  for (auto i : nes::range(episodes)){
+    state ^= state << 13;
+    state ^= state >> 17;
+    state ^= state << 5;
+    lengths.push_back(frames / 2 + state % (frames + 1));
+  }
+
+  return lengths;
+}
+
+auto main(int argc, char** argv) -> int{
+  if (argc < 5){
+    std::cout << "Usage: " << argv[0] << " <rom> <instances> <episodes> <frames per episode> [--threads n] [--quantum q] [--no-pin] [--scaling]\n";
+    return 1;
+  }
+
+  auto threads = nes::ThreadPool::default_thread_count();
+  auto quantum = nes::u32(nes::BatchRunner::DefaultQuantum);
+  auto pin = true;
+  auto scaling = false;
+
+  for (auto i = 5; i < argc; ++i){
+    const auto argument = std::string(argv[i]);
+    if (argument == "--threads" && i + 1 < argc) threads = std::stoul(argv[++i]);
+    else if (argument == "--quantum" && i + 1 < argc) quantum = std::stoul(argv[++i]);
+    else if (argument == "--no-pin") pin = false;
+    else if (argument == "--scaling") scaling = true;
+  }
+
+  try{
+    const auto rom = nes::RomImage::load(argv[1]);
+    const auto instances = nes::u32(std::stoul(argv[2]));
+    const auto lengths = episode_lengths(std::stoul(argv[3]), std::stoul(argv[4]));
+
+    //With --scaling the same batch runs on 1, 2, 4... threads up to the requested count
+    auto thread_counts = std::vector<nes::u32>{ threads };
+    if (scaling){
+      thread_counts.clear();
+      for (auto count = nes::u32(1); count < threads; count *= 2){
+        thread_counts.push_back(count);
+      }
+      thread_counts.push_back(threads);
+    }
+
+    auto single_thread_fps = 0.0;
+
+    for (const auto count : thread_counts){
+      auto pool = nes::ThreadPool(count, pin);
+      auto runner = nes::BatchRunner(rom, instances, pool);
+      runner.quantum = quantum;
+
+      const auto stats = runner.run(lengths);
+      if (count == 1) single_thread_fps = stats.fps();
+
+      std::cout
+        << std::setw(3) << count << " threads: " << stats.episodes << " episodes, " << stats.frames << " frames in "
+        << stats.seconds << "s, " << stats.fps() << " fps";
+
+      if (single_thread_fps > 0.0){
+        std::cout << ", " << stats.fps() / single_thread_fps << "x (" << 100.0 * stats.fps() / single_thread_fps / count << "% efficiency)";
+      }
+      std::cout << '\n';
+    }
+  }
+  catch(const std::runtime_error& error){
+    std::cerr << error.what() << '\n';
+    return 1;
+  }
+}
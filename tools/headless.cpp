@@ -0,0 +1,76 @@
+#include "nes.hpp"
+#include "input_script.hpp"
+
+#include <iostream>
+#include <iomanip>
+#include <chrono>
+#include <memory>
+
+//NTSC frame rate, 60.0988 frames per second of real hardware:
+static constexpr auto FramesPerSecond = double(nes::Nes::CyclesPerSec) / (262 * 341);
+
+auto main(int argc, char** argv) -> int{
+  if (argc < 3){
+    std::cout << "Usage: " << argv[0] << " <rom> <frames> [input script] [--summary] [--skip n | --timing-only]\n";
+    return 1;
+  }
+
+  auto summary_only = false;
+  auto render_mode = nes::Ppu::RenderMode::Full;
+  auto render_interval = nes::u32(1);
+
+  auto arguments = std::vector<std::string>();
+  for (auto i = 1; i < argc; ++i){
+    const auto argument = std::string(argv[i]);
+    if (argument == "--summary") summary_only = true;
+    else if (argument == "--timing-only") render_mode = nes::Ppu::RenderMode::TimingOnly;
+    else if (argument == "--skip" && i + 1 < argc){
+      render_mode = nes::Ppu::RenderMode::Skip;
+      render_interval = std::stoul(argv[++i]);
+    }
+    else arguments.push_back(argument);
+  }
+
+  if (arguments.size() < 2){
+    std::cout << "Missing <rom> or <frames>\n";
+    return 1;
+  }
+
+  const auto frames = std::stoul(arguments[1]);
+
+  try{
+    const auto script = arguments.size() > 2 ? nes::InputScript(arguments[2]) : nes::InputScript();
+
+    //Too large for the stack:
+    auto nes = std::make_unique<nes::Nes>();
+    nes->load_cardridge(arguments[0]);
+    nes->ppu.set_render_mode(render_mode, render_interval);
+
+    auto hash = nes::u32(0);
+    const auto start = std::chrono::steady_clock::now();
+
+    for (auto frame : nes::range(frames)){
+      nes->controllers[0] = script.buttons(frame, 0);
+      nes->controllers[1] = script.buttons(frame, 1);
+
+      nes->run_frame();
+      hash = nes->frame_hash();
+
+      if (!summary_only){
+        std::cout << frame << ' ' << std::hex << std::setw(8) << std::setfill('0') << hash << std::dec << '\n';
+      }
+    }
+
+    const auto elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    const auto fps = frames / elapsed;
+
+    std::cout
+      << frames << " frames in " << elapsed << "s, " << fps << " fps, "
+      << fps / FramesPerSecond << "x real time, final hash "
+      << std::hex << std::setw(8) << std::setfill('0') << hash << std::dec << '\n';
+  }
+  catch(const std::runtime_error& error){
+    std::cerr << error.what() << '\n';
+    return 1;
+  }
+}
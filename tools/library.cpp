@@ -0,0 +1,53 @@
+#include "library.hpp"
+
+#include <iostream>
+#include <iomanip>
+#include <chrono>
+
+auto main(int argc, char** argv) -> int{
+  if (argc < 2){
+    std::cout << "Usage: " << argv[0] << " <rom directory> [index file]\n";
+    return 1;
+  }
+
+  const auto directory = std::string(argv[1]);
+  const auto index_path = argc > 2 ? std::string(argv[2]) : directory + "/nes_library.idx";
+
+  auto library = nes::Library();
+  library.load(index_path);
+
+  const auto start = std::chrono::steady_clock::now();
+  {
+    auto pool = nes::ThreadPool();
+    library.scan(directory, pool);
+  }
+  const auto elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+  library.save(index_path);
+
+  auto unsupported = 0;
+  auto invalid = 0;
+
+  for (const auto& [path, entry] : library.items){
+    if (!entry.has(nes::LibraryEntry::Valid)){
+      invalid++;
+      std::cout << "invalid     " << path << '\n';
+      continue;
+    }
+
+    const auto supported = entry.has(nes::LibraryEntry::Supported);
+    if (!supported) unsupported++;
+
+    std::cout
+      << std::hex << std::setw(8) << std::setfill('0') << entry.program_crc32 << ' '
+      << std::setw(8) << std::setfill('0') << entry.char_crc32 << std::dec << std::setfill(' ')
+      << " mapper " << std::setw(3) << entry.mapper
+      << (entry.has(nes::LibraryEntry::Nes2) ? " nes2" : " ines")
+      << (supported ? "             " : " unsupported ")
+      << path << '\n';
+  }
+
+  std::cout
+    << library.items.size() << " ROMs (" << library.hashed << " hashed, " << library.reused << " unchanged), "
+    << unsupported << " unsupported, " << invalid << " invalid, " << elapsed << "s\n";
+}
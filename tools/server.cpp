@@ -0,0 +1,41 @@
+#include "server.hpp"
+
+#include <iostream>
+#include <csignal>
+
+static nes::Server* running_server = nullptr;
+
+static auto on_signal(int) -> void{
+  if (running_server){
+    running_server->stop();
+  }
+}
+
+auto main(int argc, char** argv) -> int{
+  if (argc < 2){
+    std::cout << "Usage: " << argv[0] << " <socket path> [--threads n]\n";
+    return 1;
+  }
+
+  auto threads = nes::ThreadPool::default_thread_count();
+  for (auto i = 2; i < argc; ++i){
+    const auto argument = std::string(argv[i]);
+    if (argument == "--threads" && i + 1 < argc) threads = std::stoul(argv[++i]);
+  }
+
+  try{
+    auto server = nes::Server(argv[1], threads);
+
+    running_server = &server;
+    std::signal(SIGINT, on_signal);
+    std::signal(SIGTERM, on_signal);
+
+    std::cerr << "Listening on " << argv[1] << " with " << threads << " threads\n";
+    server.run();
+    running_server = nullptr;
+  }
+  catch(const std::runtime_error& error){
+    std::cerr << error.what() << '\n';
+    return 1;
+  }
+}
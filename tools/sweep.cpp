@@ -0,0 +1,209 @@
+#include "sweep.hpp"
+
+#include <iostream>
+#include <iomanip>
+#include <fstream>
+#include <sstream>
+#include <map>
+
+struct SweepOptions{
+  std::string directory;
+  nes::u32 frames = 600;
+  nes::u32 threads = nes::ThreadPool::default_thread_count();
+  nes::Ppu::RenderMode render_mode = nes::Ppu::RenderMode::Full;
+  std::string sort = "status";
+  std::string baseline_path;
+  std::string output_path;
+  double threshold = 10.0;
+};
+
+//What a previous report says about one ROM
+struct BaselineEntry{
+  std::string status;
+  double fps = 0.0;
+  std::string hash;
+};
+
+static auto split_tabs(const std::string& line){
+  auto cells = std::vector<std::string>();
+  auto stream = std::istringstream(line);
+  auto cell = std::string();
+
+  while (std::getline(stream, cell, '\t')){
+    cells.push_back(cell);
+  }
+  return cells;
+}
+
+//Columns are found by name, so reports with or without baseline columns both work as baselines
+static auto load_baseline(const std::string& filepath){
+  auto file = std::ifstream(filepath);
+  if (!file){
+    throw std::runtime_error("Unable to open baseline: " + filepath);
+  }
+
+  auto line = std::string();
+  std::getline(file, line);
+
+  auto columns = std::map<std::string, size_t>();
+  const auto header = split_tabs(line);
+  for (auto i : nes::range(header.size())){
+    columns[header[i]] = i;
+  }
+
+  for (const auto name : { "status", "fps", "hash", "path" }){
+    if (columns.count(name) == 0){
+      throw std::runtime_error("Baseline has no " + std::string(name) + " column: " + filepath);
+    }
+  }
+
+  auto baseline = std::map<std::string, BaselineEntry>();
+  while (std::getline(file, line)){
+    const auto cells = split_tabs(line);
+    if (cells.size() < header.size() - 1) continue;
+
+    auto& entry = baseline[cells[columns["path"]]];
+    entry.status = cells[columns["status"]];
+    entry.fps = std::stod(cells[columns["fps"]]);
+    entry.hash = cells[columns["hash"]];
+  }
+
+  return baseline;
+}
+
+static auto hex(nes::u32 value, int width){
+  auto stream = std::ostringstream();
+  stream << std::hex << std::setw(width) << std::setfill('0') << value;
+  return stream.str();
+}
+
+//Failures first, worst kind first:
+static auto status_rank(nes::SweepResult::Status status){
+  using Status = nes::SweepResult::Status;
+
+  switch(status){
+    case Status::Error: return 0;
+    case Status::UnsupportedOpcode: return 1;
+    case Status::UnsupportedMapper: return 2;
+    default: return 3;
+  }
+}
+
+auto main(int argc, char** argv) -> int{
+  if (argc < 2){
+    std::cout
+      << "Usage: " << argv[0] << " <rom directory> [--frames n] [--threads n] [--timing-only]\n"
+      << "       [--sort status|fps|path|change] [--baseline previous.tsv] [--threshold percent] [--output report.tsv]\n";
+    return 1;
+  }
+
+  auto options = SweepOptions();
+  options.directory = argv[1];
+
+  for (auto i = 2; i < argc; ++i){
+    const auto argument = std::string(argv[i]);
+    const auto has_value = i + 1 < argc;
+
+    if (argument == "--frames" && has_value) options.frames = std::stoul(argv[++i]);
+    else if (argument == "--threads" && has_value) options.threads = std::stoul(argv[++i]);
+    else if (argument == "--timing-only") options.render_mode = nes::Ppu::RenderMode::TimingOnly;
+    else if (argument == "--sort" && has_value) options.sort = argv[++i];
+    else if (argument == "--baseline" && has_value) options.baseline_path = argv[++i];
+    else if (argument == "--threshold" && has_value) options.threshold = std::stod(argv[++i]);
+    else if (argument == "--output" && has_value) options.output_path = argv[++i];
+  }
+
+  try{
+    const auto baseline = options.baseline_path.empty()
+      ? std::map<std::string, BaselineEntry>()
+      : load_baseline(options.baseline_path);
+    const auto has_baseline = !options.baseline_path.empty();
+
+    const auto start = std::chrono::steady_clock::now();
+    auto results = std::vector<nes::SweepResult>();
+    {
+      auto pool = nes::ThreadPool(options.threads);
+      results = nes::sweep_directory(options.directory, options.frames, pool, options.render_mode);
+    }
+    const auto elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    //Relative fps change against the baseline, 0 when the ROM is new or failed in either run:
+    const auto change = [&](const nes::SweepResult& result){
+      const auto found = baseline.find(result.path);
+      if (found == baseline.end() || found->second.fps <= 0.0 || result.status != nes::SweepResult::Status::Ok) return 0.0;
+      return 100.0 * (result.fps() - found->second.fps) / found->second.fps;
+    };
+
+    std::stable_sort(results.begin(), results.end(), [&](const auto& a, const auto& b){
+      if (options.sort == "path") return a.path < b.path;
+      if (options.sort == "fps") return a.fps() < b.fps();
+      if (options.sort == "change") return change(a) < change(b);
+
+      const auto a_rank = status_rank(a.status);
+      const auto b_rank = status_rank(b.status);
+      return a_rank != b_rank ? a_rank < b_rank : a.fps() < b.fps();
+    });
+
+    auto file = std::ofstream();
+    if (!options.output_path.empty()){
+      file.open(options.output_path);
+      if (!file){
+        throw std::runtime_error("Unable to open file: " + options.output_path);
+      }
+    }
+    auto& out = options.output_path.empty() ? std::cout : file;
+
+    out << "status\tfps";
+    if (has_baseline) out << "\tfps_change_percent";
+    out << "\tframes\tfailing_pc\thash";
+    if (has_baseline) out << "\thash_changed";
+    out << "\tmapper\tpath\tmessage\n";
+
+    auto counts = std::map<std::string, nes::u32>();
+    auto total_frames = nes::u64(0);
+    auto regressions = 0;
+
+    for (const auto& result : results){
+      const auto status = nes::SweepResult::status_name(result.status);
+      const auto hash = hex(result.hash, 8);
+      const auto found = baseline.find(result.path);
+
+      counts[status]++;
+      total_frames += result.frames;
+
+      //Slower beyond the threshold, or failing where the baseline ran:
+      const auto newly_failing = found != baseline.end() && found->second.status == "ok" && result.status != nes::SweepResult::Status::Ok;
+      if (newly_failing || change(result) < -options.threshold){
+        regressions++;
+      }
+
+      auto message = result.message;
+      std::replace(message.begin(), message.end(), '\t', ' ');
+      std::replace(message.begin(), message.end(), '\n', ' ');
+
+      out << status << '\t' << std::fixed << std::setprecision(1) << result.fps();
+      if (has_baseline) out << '\t' << change(result);
+      out << '\t' << result.frames << '\t' << (result.failed_in_cpu ? hex(result.failing_pc, 4) : "-") << '\t' << hash;
+      if (has_baseline) out << '\t' << (found != baseline.end() && found->second.hash != hash ? "yes" : "no");
+      out << '\t' << result.mapper << '\t' << result.path << '\t' << message << '\n';
+    }
+
+    std::cerr << results.size() << " ROMs:";
+    for (const auto& [status, count] : counts){
+      std::cerr << ' ' << status << ' ' << count;
+    }
+    std::cerr
+      << ", " << total_frames / elapsed << " frames/s on " << options.threads << " threads, " << elapsed << "s";
+
+    if (has_baseline){
+      std::cerr << ", " << regressions << " regressions beyond " << options.threshold << "%";
+    }
+    std::cerr << '\n';
+
+    return regressions > 0 ? 2 : 0;
+  }
+  catch(const std::runtime_error& error){
+    std::cerr << error.what() << '\n';
+    return 1;
+  }
+}